@@ -0,0 +1,372 @@
+#include <QTextStream>
+#include <QFile>
+#include <QDebug>
+
+#include "batchquery.h"
+#include "gbquery.h"
+#include "shardplanner.h"
+
+// A 'BatchQuery' runs many organism/marker queries in the same process. All
+// of them share a single 'Scheduler' (and thus a single QNetworkAccessManager
+// with its connections), so NCBI's rate limit applies to the batch as a whole
+// and at most a fixed number of requests are in flight at any time. Only
+// '_maxActive' queries run at the same time; when one finishes the next one
+// in the list is launched. GIs returned by several queries are fetched only
+// once (see 'GbQuery::setSharedIds'). The 'quit' SIGNAL is emitted when every
+// query has finished.
+//
+// Queries are read from a text file with one query per line: the organism
+// name, optionally followed by a TAB and the marker/gene name (COI is the
+// default) and by another TAB and the fetch profile ('gb-xml', 'fasta' or
+// 'summary'; the batch default when missing). Empty lines and lines starting
+// with '#' are ignored.
+//
+// Corophium volutator<TAB>COI
+// Munna minuta<TAB>16S<TAB>fasta
+//
+// With 'setSharding', every query is first split into date ranges of at most
+// a given number of records (see 'shardplanner.cpp'), and each range is then
+// run as a query of its own.
+
+BatchQuery::BatchQuery( QObject *parent )
+    : QObject( parent )
+{
+    _scheduler = new Scheduler( this );
+    qDebug() << "Constructing BatchQuery";
+}
+
+// The batch may run under a scheduler created beforehand (one whose
+// connection is already being opened, say). Its limits are still set by the
+// batch.
+
+BatchQuery::BatchQuery( Scheduler *scheduler, QObject *parent )
+    : QObject( parent )
+{
+    _scheduler = scheduler;
+    qDebug() << "Constructing BatchQuery";
+}
+
+BatchQuery::~BatchQuery()
+{
+    qDebug() << "Destructing BatchQuery";
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'load' reads the list of queries from a file. It returns false if the     */
+/* file cannot be read.                                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+bool BatchQuery::load( const QString &fileName )
+{
+    QFile file( fileName );
+
+    if( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        _errorMessage = "Cannot read batch file: " + file.errorString();
+        return false;
+    }
+
+    QTextStream in( &file );
+    QString     line;
+
+    while( in.readLineInto( &line ) )
+    {
+        line = line.trimmed();
+        if( line.isEmpty() || line.startsWith( '#' ) ) continue;
+
+        QStringList fields = line.split( '\t' );
+        FetchProfile profile = _profile;
+
+        if( fields.size() > 2 &&
+            !RecordParser::profileFromString( fields.at( 2 ).trimmed(), profile ) )
+        {
+            _errorMessage = "Unknown fetch profile in batch file: " + fields.at( 2 );
+            return false;
+        }
+
+        addQuery( fields.at( 0 ), fields.size() > 1 ? fields.at( 1 ) : "COI",
+                  profile );
+    }
+    return true;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'addQuery' appends an organism/marker pair to the batch. Organism names   */
+/* are prepared for URLs just like single queries are in 'main'.             */
+/*                                                                           */
+/*****************************************************************************/
+
+void BatchQuery::addQuery( const QString organism, const QString marker )
+{
+    addQuery( organism, marker, _profile );
+}
+
+void BatchQuery::addQuery( const QString organism,
+                           const QString marker,
+                           FetchProfile profile )
+{
+    QString o = organism.simplified();
+    o.replace( " ", "+" );
+
+    QString m = marker.simplified();
+    if( m.isEmpty() || m.contains( " " ) )
+    {
+        qDebug() << "provide a single marker/gene name for" << organism;
+        m = "COI";
+    }
+
+    _queries.append( { o, m, profile } );
+}
+
+void BatchQuery::setQueryParams( const QString key, const ulong retMaxRecords )
+{
+    _apiKey = key;
+    _retMax = retMaxRecords;
+
+    // NCBI allows 10 requests per second with an API Key, 3 otherwise. This
+    // is the budget for the whole batch.
+
+    _scheduler->setRate( _apiKey != "" ? 10.0 : 3.0 );
+}
+
+void BatchQuery::setConcurrency( int requests )
+{
+    _scheduler->setMaxInFlight( requests );
+}
+
+void BatchQuery::setMaxActive( int queries )
+{
+    _maxActive = queries > 0 ? queries : 1;
+}
+
+// The profile of queries whose line in the batch file does not name one.
+// It must be set before 'load'.
+
+void BatchQuery::setProfile( FetchProfile profile )
+{
+    _profile = profile;
+}
+
+void BatchQuery::setProjection( const Projection &projection )
+{
+    _projection = projection;
+}
+
+void BatchQuery::setRetries( int retries )
+{
+    _retries = retries;
+}
+
+void BatchQuery::setAdaptive( bool adaptive )
+{
+    _adaptive = adaptive;
+}
+
+// Every query of the batch adds to the same metrics
+
+void BatchQuery::setMetrics( Metrics *metrics )
+{
+    _metrics = metrics;
+}
+
+// Every query of the batch goes to the same eutils server
+
+void BatchQuery::setEndpoint( const QString &scheme, const QString &host, int port )
+{
+    _scheme = scheme;
+    _host   = host;
+    _port   = port;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setSharding' splits queries of more than 'records' records into ranges   */
+/* of publication ('pdat') or modification ('mdat') dates before they run.   */
+/* Zero (the default) runs every query whole.                                */
+/*                                                                           */
+/*****************************************************************************/
+
+void BatchQuery::setSharding( const QString &dateType, ulong records )
+{
+    _dateType     = dateType;
+    _maxShardSize = records;
+}
+
+void BatchQuery::setRecordStore( GbRecordStore *store )
+{
+    _store = store;
+}
+
+void BatchQuery::setRecordSink( RecordSink *sink )
+{
+    _sink = sink;
+}
+
+void BatchQuery::setRecordCache( RecordCache *cache )
+{
+    _cache = cache;
+}
+
+QString BatchQuery::errorMessage()
+{
+    return _errorMessage;
+}
+
+// A batch has failed if any of its queries has
+
+bool BatchQuery::hasFailed()
+{
+    return _failed;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'start' launches the first '_maxActive' queries                           */
+/*                                                                           */
+/*****************************************************************************/
+
+void BatchQuery::start()
+{
+    if( _queries.isEmpty() )
+    {
+        emit quit();
+        return;
+    }
+
+    if( _maxShardSize > 0 && !_planned )
+    {
+        plan();
+        return;
+    }
+
+    while( _active < _maxActive && _next < _queries.size() )
+    {
+        launch();
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'plan' runs a 'ShardPlanner' for every query, all of them at once through */
+/* the shared scheduler. 'planned' replaces each query by its shards, and    */
+/* the batch starts once the last query is planned. A query that cannot be   */
+/* planned runs whole.                                                       */
+/*                                                                           */
+/*****************************************************************************/
+
+void BatchQuery::plan()
+{
+    _planning = _queries.size();
+    _shards.resize( _queries.size() );
+
+    for( qsizetype i = 0; i < _queries.size(); ++i )
+    {
+        const Query &q = _queries.at( i );
+
+        ShardPlanner *planner = new ShardPlanner( _scheduler, this );
+
+        connect( planner, &ShardPlanner::planned,
+                 this,    [this, planner, i]() { planned( planner, i ); } );
+
+        planner->setQueryParams( q.organism, q.marker, _apiKey );
+        planner->setDateType( _dateType );
+        planner->setMaxShardSize( _maxShardSize );
+        planner->setRetries( _retries );
+        if( _host != "" ) planner->setEndpoint( _scheme, _host, _port );
+
+        planner->plan();
+    }
+}
+
+void BatchQuery::planned( ShardPlanner *planner, qsizetype index )
+{
+    planner->deleteLater();
+
+    const Query &q = _queries.at( index );
+
+    if( planner->hasFailed() )
+    {
+        qDebug() << "Running" << q.organism << q.marker << "unsharded";
+        _shards[index].append( q );
+    }
+    else
+    {
+        for( const ShardPlanner::Shard &shard : planner->shards() )
+        {
+            _shards[index].append( { q.organism, q.marker, q.profile,
+                                     shard.minDate, shard.maxDate } );
+        }
+    }
+
+    if( --_planning > 0 ) return;
+
+    _queries.clear();
+    for( const QList<Query> &shards : std::as_const( _shards ) ) _queries.append( shards );
+    _shards.clear();
+
+    _planned = true;
+    start();
+}
+
+void BatchQuery::launch()
+{
+    const Query &q = _queries.at( _next++ );
+
+    GbQuery *query = new GbQuery( _scheduler, this );
+
+    connect( query, &GbQuery::quit,
+             this,  &BatchQuery::queryFinished );
+
+    connect( query, &GbQuery::search,
+             query, &GbQuery::searchNCBI );
+
+    query->setQueryParams( q.organism, q.marker, _apiKey, _retMax );
+    query->setDateRange( _dateType, q.minDate, q.maxDate );
+    query->setProfile( q.profile );
+    query->setProjection( _projection );
+    query->setRetries( _retries );
+    query->setAdaptive( _adaptive );
+    query->setMetrics( _metrics );
+    if( _host != "" ) query->setEndpoint( _scheme, _host, _port );
+    query->setRecordStore( _store );
+    query->setRecordSink( _sink );
+    query->setRecordCache( _cache );
+    query->setSharedIds( &_sharedIds );
+
+    _active++;
+
+    emit query->search( 0 );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'queryFinished' is a SLOT linked to the 'quit' SIGNAL of every query. It  */
+/* launches the next query, or emits 'quit' when all of them are done.       */
+/*                                                                           */
+/*****************************************************************************/
+
+void BatchQuery::queryFinished()
+{
+    GbQuery *query = qobject_cast<GbQuery*>( sender() );
+
+    query->deleteLater();
+
+    if( query->hasFailed() ) _failed = true;
+
+    _active--;
+    _finished++;
+
+    qDebug() << "Finished query" << _finished << "of" << _queries.size();
+
+    if( _next < _queries.size() )
+    {
+        launch();
+    }
+    else if( _finished == _queries.size() )
+    {
+        emit quit();
+    }
+}
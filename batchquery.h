@@ -0,0 +1,108 @@
+#ifndef BATCHQUERY_H
+#define BATCHQUERY_H
+
+#include <QString>
+#include <QList>
+#include <QSet>
+#include <QDate>
+#include <QObject>
+
+#include "recordparser.h"
+#include "scheduler.h"
+
+class GbQuery;
+class GbRecordStore;
+class RecordSink;
+class RecordCache;
+class Metrics;
+class ShardPlanner;
+
+class BatchQuery : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit        BatchQuery( QObject * parent = nullptr );
+                    BatchQuery( Scheduler *, QObject * parent = nullptr );
+    ~BatchQuery();
+    bool            load( const QString & );
+    void            addQuery( const QString, const QString );
+    void            addQuery( const QString, const QString, FetchProfile );
+    void            setQueryParams( const QString, const ulong );
+    void            setConcurrency( int );
+    void            setMaxActive( int );
+    void            setProfile( FetchProfile );
+    void            setProjection( const Projection & );
+    void            setRetries( int );
+    void            setAdaptive( bool );
+    void            setMetrics( Metrics * );
+    void            setEndpoint( const QString &, const QString &, int port = -1 );
+    void            setSharding( const QString &, ulong );
+    void            setRecordStore( GbRecordStore * );
+    void            setRecordSink( RecordSink * );
+    void            setRecordCache( RecordCache * );
+    QString         errorMessage();
+    bool            hasFailed();
+
+signals:
+    void            quit();
+
+public slots:
+    void            start();
+
+private:
+    QString         _apiKey         {""};
+    ulong           _retMax         {20};
+    int             _maxActive      {8};
+    FetchProfile    _profile        {FetchProfile::GbXml};
+    Projection      _projection;
+    int             _retries        {5};
+    bool            _adaptive       {true};
+    QString         _scheme         {""};
+    QString         _host           {""};
+    int             _port           {-1};
+    QString         _dateType       {"pdat"};
+    ulong           _maxShardSize   {0};
+    qsizetype       _planning       {0};
+    bool            _planned        {false};
+    bool            _failed         {false};
+    int             _active         {0};
+    qsizetype       _next           {0};
+    qsizetype       _finished       {0};
+    QString         _errorMessage   {"No error reading batch file"};
+
+    struct Query
+    {
+        QString         organism;
+        QString         marker;
+        FetchProfile    profile;
+        QDate           minDate;
+        QDate           maxDate;
+    };
+
+    QList<Query>                    _queries;
+
+    // The shards of every query, once planned
+
+    QList<QList<Query>>             _shards;
+
+    // GIs claimed by any query of the batch
+
+    QSet<ulong>                     _sharedIds;
+
+    GbRecordStore                   *_store         {nullptr};
+    RecordSink                      *_sink          {nullptr};
+    RecordCache                     *_cache         {nullptr};
+    Metrics                         *_metrics       {nullptr};
+
+    Scheduler                       *_scheduler;
+
+    void            plan();
+    void            planned( ShardPlanner *, qsizetype );
+    void            launch();
+
+private slots:
+    void            queryFinished();
+};
+
+#endif // BATCHQUERY_H
@@ -0,0 +1,120 @@
+#include <QDebug>
+
+#include "batchsizer.h"
+
+// A 'BatchSizer' chooses the number of records (the 'retmax') asked for in
+// every request to an eutils endpoint. Small batches mean thousands of round
+// trips for a large taxon; large batches of records with huge feature tables
+// take so long that they time out. So the size adapts to what is observed:
+//
+// - the time per record and the bytes per record of every successful reply
+//   are averaged (exponentially weighted), and the next size is the one
+//   expected to take '_target' seconds without exceeding '_maxBytes'. The
+//   fixed cost of a round trip makes small batches look slow per record,
+//   so they grow.
+// - a size grows at most twofold at a time, and not at all while requests
+//   keep failing.
+// - a failed request (a timeout, a 5xx error or a truncated reply) halves it.
+//
+// The size stays within '_minimum' and '_maximum' (NCBI serves at most 10000
+// records per request). An explicit size (given with '--retmax') is never
+// changed.
+
+namespace
+{
+
+const double weight {0.3};
+
+}
+
+BatchSizer::BatchSizer()
+{
+}
+
+BatchSizer::~BatchSizer()
+{
+}
+
+// The initial size, or the size for good if the sizer is not adaptive
+
+void BatchSizer::setSize( ulong size )
+{
+    _size = qBound( 1ul, size, _maximum );
+}
+
+void BatchSizer::setAdaptive( bool adaptive )
+{
+    _adaptive = adaptive;
+}
+
+void BatchSizer::setLimits( ulong minimum, ulong maximum )
+{
+    _minimum = qMax( 1ul, minimum );
+    _maximum = qMax( _minimum, maximum );
+    _size    = qBound( _minimum, _size, _maximum );
+}
+
+ulong BatchSizer::size()
+{
+    return _size;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'observe' accounts for a successful request that brought 'records'        */
+/* records and 'bytes' (decoded) bytes in 'seconds', from its submission to  */
+/* its last byte, and adapts the size of the next requests                   */
+/*                                                                           */
+/*****************************************************************************/
+
+void BatchSizer::observe( ulong records, double seconds, qint64 bytes )
+{
+    _errorRate *= 1.0 - weight;
+
+    if( !_adaptive || records == 0 ) return;
+
+    double secondsPerRecord = seconds / records;
+    double bytesPerRecord   = double( bytes ) / records;
+
+    if( _secondsPerRecord == 0.0 )
+    {
+        _secondsPerRecord = secondsPerRecord;
+        _bytesPerRecord   = bytesPerRecord;
+    }
+    else
+    {
+        _secondsPerRecord += weight * ( secondsPerRecord - _secondsPerRecord );
+        _bytesPerRecord   += weight * ( bytesPerRecord - _bytesPerRecord );
+    }
+
+    double ideal = _target / qMax( _secondsPerRecord, 1e-6 );
+
+    if( _bytesPerRecord > 0.0 ) ideal = qMin( ideal, _maxBytes / _bytesPerRecord );
+
+    ulong size = ideal > _maximum ? _maximum : ulong( ideal );
+
+    if( size > _size )
+    {
+        if( _errorRate > 0.05 ) return;
+        size = qMin( size, 2 * _size );
+    }
+
+    size = qBound( _minimum, size, _maximum );
+
+    if( size != _size )
+    {
+        qDebug() << "Batch size" << _size << "->" << size
+                 << "(" << _secondsPerRecord * 1000 << "ms and"
+                 << _bytesPerRecord << "bytes per record )";
+        _size = size;
+    }
+}
+
+void BatchSizer::observeFailure()
+{
+    _errorRate += weight * ( 1.0 - _errorRate );
+
+    if( !_adaptive ) return;
+
+    _size = qMax( _minimum, _size / 2 );
+}
@@ -0,0 +1,29 @@
+#ifndef BATCHSIZER_H
+#define BATCHSIZER_H
+
+#include <QtGlobal>
+
+class BatchSizer
+{
+    ulong               _size           {200};
+    ulong               _minimum        {20};
+    ulong               _maximum        {10000};
+    bool                _adaptive       {true};
+    double              _target         {10.0};
+    qint64              _maxBytes       {64 << 20};
+    double              _secondsPerRecord {0.0};
+    double              _bytesPerRecord {0.0};
+    double              _errorRate      {0.0};
+
+public:
+    BatchSizer();
+    ~BatchSizer();
+    void            setSize( ulong );
+    void            setAdaptive( bool );
+    void            setLimits( ulong, ulong );
+    ulong           size();
+    void            observe( ulong, double, qint64 );
+    void            observeFailure();
+};
+
+#endif // BATCHSIZER_H
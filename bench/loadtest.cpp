@@ -0,0 +1,377 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QHostAddress>
+#include <QTemporaryDir>
+#include <QHash>
+
+#include "gbquery.h"
+#include "recordparser.h"
+#include "recordcache.h"
+#include "projection.h"
+#include "scheduler.h"
+#include "mockeutils.h"
+#include "synthetic.h"
+
+// End-to-end load test. A 'MockEutils' server is started on a local port
+// and a GbQuery pulls its whole synthetic result set, through the same
+// scheduler, transfers, parsers, retries and paging as a real query. The
+// total wall time, the records received and the requests seen by the server
+// are printed as a single JSON object. The records received are checked
+// against the result set of the server: the exit status is 1 if the query
+// failed, or if any record is missing, was received twice, or is not one of
+// the server's (a GI with the accession of another, say).
+//
+// ncbiquery_loadtest --records 1000000 --retmax 500 --latency 50 --throttle 0.02
+//
+// With '--serve' only the server is started, so that ncbiquery itself can be
+// pointed at it:
+//
+// ncbiquery_loadtest --serve --port 8080 --records 100000
+// ncbiquery --eutils http://127.0.0.1:8080 --output /dev/null Synthetic COI
+//
+// With '--warm' the result set is pulled a second time through the cache
+// filled by the first pull (in '--cache <directory>', or in a temporary
+// one), and both pulls must give the same records, field by field.
+//
+// ncbiquery_loadtest --records 10000 --warm --fields sequence,specimen_voucher
+
+namespace
+{
+
+// The fields of a record, as one string to compare pulls with
+
+QByteArray fields( const GbRecord &r )
+{
+    QByteArray out = QByteArray::number( qulonglong( r.gi ) );
+
+    out += '\t' + r.accession.toUtf8() + '\t' + r.organism.toUtf8() + '\t' +
+           r.country.toUtf8() + '\t' + r.sequence;
+
+    for( const QString &q : r.qualifiers ) out += '\t' + q.toUtf8();
+
+    return out;
+}
+
+// The key of a record: its GI, or with FASTA (which carries no GI) the number
+// of its accession. Accessions of the mock repeat every million GIs, so keys
+// are counted rather than just collected.
+
+ulong recordKey( ulong gi, bool byGi )
+{
+    return byGi ? gi : gi % 1000000;
+}
+
+ulong recordKey( const GbRecord &r, bool byGi )
+{
+    return byGi ? r.gi : r.accession.mid( 2, 6 ).toULong();
+}
+
+}
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+    QCoreApplication::setApplicationName( "ncbiquery_loadtest" );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Load test ncbiquery against a mock eutils server" );
+    parser.addHelpOption();
+
+    QCommandLineOption recordsOption( "records",
+        "Number of records of the result set (default: 10000).", "n", "10000" );
+    QCommandLineOption retMaxOption( "retmax",
+        "Records per page (default: 500).", "n", "500" );
+    QCommandLineOption adaptiveOption( "adaptive",
+        "Let the number of records per page adapt, starting at --retmax." );
+    QCommandLineOption profileOption( "profile",
+        "Fetch profile: gb-xml, fasta or summary (default: gb-xml).",
+        "profile", "gb-xml" );
+    QCommandLineOption giModeOption( "no-history",
+        "Page over the GIs returned by 'esearch' instead of the History "
+        "server (as with a cache or in batch mode)." );
+    QCommandLineOption concurrencyOption( "concurrency",
+        "Maximum number of requests in flight (default: 4).", "n", "4" );
+    QCommandLineOption rateOption( "rate",
+        "Requests per second allowed by the scheduler (default: 1000).",
+        "n", "1000" );
+    QCommandLineOption retriesOption( "retries",
+        "Number of times a failed request is retried (default: 5).", "n", "5" );
+    QCommandLineOption latencyOption( "latency",
+        "Delay of every reply (default: 0).", "ms", "0" );
+    QCommandLineOption throttleOption( "throttle",
+        "Fraction of the requests answered with HTTP 429 (default: 0).",
+        "fraction", "0" );
+    QCommandLineOption truncateOption( "truncate",
+        "Fraction of the replies cut in half (default: 0).", "fraction", "0" );
+    QCommandLineOption plainOption( "no-compression",
+        "Do not compress the replies." );
+    QCommandLineOption serveOption( "serve",
+        "Only run the mock server." );
+    QCommandLineOption portOption( "port",
+        "Port of the mock server (default: any free port).", "port", "0" );
+    QCommandLineOption fieldsOption( "fields",
+        "Fields of every record (see ncbiquery --fields).", "list" );
+    QCommandLineOption cacheOption( "cache",
+        "Keep the records in a cache in <directory>.", "directory" );
+    QCommandLineOption warmOption( "warm",
+        "Pull the result set again through the cache filled by the first "
+        "pull, and check that both pulls give the same records." );
+    QCommandLineOption verboseOption( "verbose",
+        "Keep the debug output of GbQuery." );
+
+    parser.addOption( recordsOption );
+    parser.addOption( retMaxOption );
+    parser.addOption( adaptiveOption );
+    parser.addOption( profileOption );
+    parser.addOption( giModeOption );
+    parser.addOption( concurrencyOption );
+    parser.addOption( rateOption );
+    parser.addOption( retriesOption );
+    parser.addOption( latencyOption );
+    parser.addOption( throttleOption );
+    parser.addOption( truncateOption );
+    parser.addOption( plainOption );
+    parser.addOption( serveOption );
+    parser.addOption( portOption );
+    parser.addOption( fieldsOption );
+    parser.addOption( cacheOption );
+    parser.addOption( warmOption );
+    parser.addOption( verboseOption );
+
+    parser.process( a );
+
+    QTextStream out( stdout );
+    QTextStream err( stderr );
+
+    ulong records = parser.value( recordsOption ).toULong();
+
+    MockEutils server;
+    server.setRecords( records );
+    server.setLatency( parser.value( latencyOption ).toInt() );
+    server.setThrottleRate( parser.value( throttleOption ).toDouble() );
+    server.setTruncateRate( parser.value( truncateOption ).toDouble() );
+    server.setCompression( !parser.isSet( plainOption ) );
+
+    if( !server.listen( QHostAddress::LocalHost, parser.value( portOption ).toUShort() ) )
+    {
+        err << "Cannot start the mock server: " << server.errorString() << "\n";
+        return 1;
+    }
+
+    if( parser.isSet( serveOption ) )
+    {
+        err << "Serving " << records << " records at http://127.0.0.1:"
+            << server.serverPort() << "\n";
+        return a.exec();
+    }
+
+    FetchProfile profile {FetchProfile::GbXml};
+
+    if( !RecordParser::profileFromString( parser.value( profileOption ), profile ) )
+    {
+        err << "Unknown fetch profile " << parser.value( profileOption ) << "\n";
+        return 1;
+    }
+
+    Projection projection;
+
+    if( parser.isSet( fieldsOption ) &&
+        !Projection::fromString( parser.value( fieldsOption ), projection ) )
+    {
+        err << "Invalid list of fields " << parser.value( fieldsOption ) << "\n";
+        return 1;
+    }
+
+    // A warm pull needs a cache, in a temporary directory unless given
+
+    bool          warm = parser.isSet( warmOption );
+    QTemporaryDir temporary;
+    QString       cacheDirectory;
+
+    if( parser.isSet( cacheOption ) )
+    {
+        cacheDirectory = parser.value( cacheOption );
+    }
+    else if( warm )
+    {
+        cacheDirectory = temporary.path();
+    }
+
+    if( !parser.isSet( verboseOption ) )
+    {
+        qInstallMessageHandler( []( QtMsgType, const QMessageLogContext &, const QString & ) {} );
+    }
+
+    // The scheduler is our own, so that NCBI's rate limit does not apply
+
+    Scheduler *scheduler = new Scheduler( &a );
+    scheduler->setRate( parser.value( rateOption ).toDouble() );
+    scheduler->setMaxInFlight( parser.value( concurrencyOption ).toInt() );
+
+    // One pull of the whole result set. The cache is opened anew for every
+    // pull, as by separate runs.
+
+    // Every record of the server is expected once
+
+    const bool byGi = profile != FetchProfile::Fasta;
+
+    QHash<ulong, int> expected;
+    for( const ulong gi : server.ids() ) expected[ recordKey( gi, byGi ) ]++;
+
+    ulong   received        {0};
+    ulong   duplicates      {0};
+    ulong   missing         {0};
+    ulong   unexpected      {0};
+    bool    failed          {false};
+    qint64  requests        {0};
+    qint64  connections     {0};
+    qint64  bytesOnWire     {0};
+    qint64  bytesDecoded    {0};
+
+    auto pull = [&]( QHash<ulong, QByteArray> *kept ) {
+        RecordCache *cache {nullptr};
+
+        if( cacheDirectory != "" )
+        {
+            cache = new RecordCache( cacheDirectory );
+            if( cache->hasError() )
+            {
+                err << cache->errorMessage() << "\n";
+                delete cache;
+                failed = true;
+                return;
+            }
+        }
+
+        GbQuery *query = new GbQuery( scheduler, &a );
+
+        query->setEndpoint( "http", "127.0.0.1", server.serverPort() );
+        query->setQueryParams( "Synthetic", "COI", "", parser.value( retMaxOption ).toULong() );
+        query->setUseHistory( !parser.isSet( giModeOption ) );
+        query->setAdaptive( parser.isSet( adaptiveOption ) );
+        query->setConcurrency( parser.value( concurrencyOption ).toInt() );
+        query->setProfile( profile );
+        query->setProjection( projection );
+        query->setRecordCache( cache );
+        query->setRetries( parser.value( retriesOption ).toInt() );
+
+        received   = 0;
+        unexpected = 0;
+
+        QHash<ulong, int> seen;
+
+        GbQuery::connect( query, &GbQuery::record,
+                          [&, kept]( const GbRecord &r ) {
+            received++;
+            if( byGi && r.accession != Synthetic::accession( r.gi ) ) unexpected++;
+            seen[ recordKey( r, byGi ) ]++;
+            if( kept ) kept->insert( recordKey( r, byGi ), fields( r ) );
+        } );
+        GbQuery::connect( query, &GbQuery::quit,
+                          &a, &QCoreApplication::quit, Qt::QueuedConnection );
+        GbQuery::connect( query, &GbQuery::search,
+                          query, &GbQuery::searchNCBI );
+
+        emit query->search( 0 );
+
+        a.exec();
+
+        failed       = query->hasFailed();
+        requests     = query->requestsSent();
+        connections  = query->connectionsOpened();
+        bytesOnWire  = query->bytesOnWire();
+        bytesDecoded = query->bytesDecoded();
+
+        delete query;
+        delete cache;
+
+        // Compare the records received with those of the server
+
+        duplicates = 0;
+        missing    = 0;
+
+        for( auto i = seen.cbegin(); i != seen.cend(); ++i )
+        {
+            const int wanted = expected.value( i.key(), 0 );
+            if( wanted == 0 )
+            {
+                unexpected += i.value();
+            }
+            else if( i.value() > wanted )
+            {
+                duplicates += i.value() - wanted;
+            }
+        }
+        for( auto i = expected.cbegin(); i != expected.cend(); ++i )
+        {
+            const int got = seen.value( i.key(), 0 );
+            if( got < i.value() ) missing += i.value() - got;
+        }
+    };
+
+    QHash<ulong, QByteArray> cold;
+    QHash<ulong, QByteArray> hot;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    pull( warm ? &cold : nullptr );
+
+    double seconds = timer.nsecsElapsed() / 1e9;
+
+    const MockEutils::Stats stats = server.stats();
+
+    QJsonObject result;
+
+    result["records"]       = double( records );
+    result["received"]      = double( received );
+    result["seconds"]       = seconds;
+    result["records_per_s"] = received / seconds;
+    result["esearch"]       = double( stats.esearch );
+    result["epost"]         = double( stats.epost );
+    result["efetch"]        = double( stats.efetch );
+    result["esummary"]      = double( stats.esummary );
+    result["throttled"]     = double( stats.throttled );
+    result["truncated"]     = double( stats.truncated );
+    result["bytes_served"]  = double( stats.bytes );
+    result["bytes_on_wire"] = double( bytesOnWire );
+    result["bytes_decoded"] = double( bytesDecoded );
+    result["requests"]      = double( requests );
+    result["connections"]   = double( connections );
+    result["duplicates"]    = double( duplicates );
+    result["missing"]       = double( missing );
+    result["unexpected"]    = double( unexpected );
+    result["failed"]        = failed;
+
+    bool ok = !failed && duplicates == 0 && missing == 0 && unexpected == 0;
+
+    // The warm pull must give the same records as the cold one
+
+    if( warm && ok )
+    {
+        timer.restart();
+
+        pull( &hot );
+
+        const MockEutils::Stats after = server.stats();
+
+        bool identical = !failed && duplicates == 0 && missing == 0 &&
+                         unexpected == 0 && hot == cold;
+
+        result["warm_seconds"]   = timer.nsecsElapsed() / 1e9;
+        result["warm_received"]  = double( received );
+        result["warm_efetch"]    = double( after.efetch + after.esummary -
+                                           stats.efetch - stats.esummary );
+        result["warm_identical"] = identical;
+
+        ok = identical;
+    }
+
+    out << QJsonDocument( result ).toJson( QJsonDocument::Compact ) << Qt::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,488 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QFile>
+#include <QHash>
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+#if defined( Q_OS_UNIX )
+#include <sys/resource.h>
+#endif
+
+#include "esearch.h"
+#include "recordparser.h"
+#include "synthetic.h"
+
+// Microbenchmark of the reply parsers. Every parser is run over a recorded
+// reply (from 'fixtures') and over a synthetic reply of any number of records
+// (see 'synthetic.cpp'). Incremental parsers are fed in chunks, as they are
+// fed from the network. For every parser and input one JSON object is
+// printed per line:
+//
+// {"parser":"efetch","input":"synthetic","bytes":...,"records":...,
+//  "runs":...,"seconds":...,"mb_per_s":...,"records_per_s":...,
+//  "allocs_per_record":...,"peak_rss_kb":...}
+//
+// With '--compare <file>' the results are checked against a previous run and
+// the program exits with status 1 if any throughput dropped (or allocations
+// per record grew) by more than '--tolerance' percent.
+//
+// ncbiquery_bench --records 100000 > baseline.jsonl
+// ncbiquery_bench --records 100000 --compare baseline.jsonl
+
+/*****************************************************************************/
+/*                                                                           */
+/* Allocation counting. On glibc 'malloc' and friends are interposed, so the */
+/* buffers of QByteArray/QString (which do not go through 'operator new')    */
+/* are counted too. Elsewhere only 'operator new' is counted.                */
+/*                                                                           */
+/*****************************************************************************/
+
+namespace
+{
+
+std::atomic<quint64> allocations {0};
+
+}
+
+#if defined( __GLIBC__ )
+
+extern "C"
+{
+
+void *__libc_malloc( size_t );
+void *__libc_calloc( size_t, size_t );
+void *__libc_realloc( void *, size_t );
+
+void *malloc( size_t size ) noexcept
+{
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_malloc( size );
+}
+
+void *calloc( size_t count, size_t size ) noexcept
+{
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_calloc( count, size );
+}
+
+void *realloc( void *ptr, size_t size ) noexcept
+{
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    return __libc_realloc( ptr, size );
+}
+
+}
+
+#else
+
+void *operator new( std::size_t size )
+{
+    allocations.fetch_add( 1, std::memory_order_relaxed );
+    if( void *p = std::malloc( size ? size : 1 ) ) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete( void *p ) noexcept
+{
+    std::free( p );
+}
+
+void operator delete( void *p, std::size_t ) noexcept
+{
+    std::free( p );
+}
+
+#endif
+
+namespace
+{
+
+// Peak resident set size in KiB. On Linux the peak is reset before every
+// measurement, so it is the peak of that parser alone (plus its input).
+
+void resetPeakRss()
+{
+#if defined( Q_OS_LINUX )
+    QFile file( "/proc/self/clear_refs" );
+    if( file.open( QIODevice::WriteOnly ) ) file.write( "5" );
+#endif
+}
+
+qint64 peakRss()
+{
+#if defined( Q_OS_LINUX )
+    QFile file( "/proc/self/status" );
+    if( file.open( QIODevice::ReadOnly ) )
+    {
+        const QList<QByteArray> lines = file.readAll().split( '\n' );
+        for( const QByteArray &line : lines )
+        {
+            if( line.startsWith( "VmHWM:" ) )
+            {
+                return line.mid( 6 ).trimmed().split( ' ' ).first().toLongLong();
+            }
+        }
+    }
+#endif
+#if defined( Q_OS_UNIX )
+    struct rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) == 0 )
+    {
+#if defined( Q_OS_MACOS )
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+// A parser run over a whole input. It returns the number of records parsed,
+// or -1 on a parse error.
+
+using ParseFunction = std::function<qint64( const QByteArray & )>;
+
+struct Options
+{
+    qsizetype   chunk       {16384};
+    int         minRuns     {3};
+    qint64      minTime     {500};
+};
+
+Options options;
+
+qint64 parseEsearch( const QByteArray &input )
+{
+    Esearch p( input );
+    return p.hasError() ? -1 : p.idList().size();
+}
+
+qint64 parseIncremental( FetchProfile profile, const QByteArray &input,
+                         const Projection &projection = Projection() )
+{
+    RecordParser *p = RecordParser::create( profile );
+    qint64 records {0};
+
+    p->setProjection( projection );
+    p->setRecordHandler( [&records]( const GbRecord & ) {
+        records++;
+    } );
+
+    // 'fromRawData' feeds the chunks without copying them
+
+    for( qsizetype i = 0; i < input.size(); i += options.chunk )
+    {
+        p->addData( QByteArray::fromRawData( input.constData() + i,
+                                             qMin( options.chunk, input.size() - i ) ) );
+    }
+    p->finish();
+
+    if( p->hasError() )
+    {
+        QTextStream( stderr ) << p->errorMessage() << "\n";
+        records = -1;
+    }
+    delete p;
+    return records;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'measure' runs a parser over an input at least 'minRuns' times and for at */
+/* least 'minTime' milliseconds, and reports the totals                      */
+/*                                                                           */
+/*****************************************************************************/
+
+QJsonObject measure( const QString &parser,
+                     const QString &input,
+                     const QByteArray &data,
+                     const ParseFunction &parse )
+{
+    QJsonObject result;
+
+    result["parser"] = parser;
+    result["input"]  = input;
+
+    // Warm up (and check) once
+
+    if( parse( data ) < 0 )
+    {
+        result["error"] = "parse error";
+        return result;
+    }
+
+    resetPeakRss();
+
+    qint64  records {0};
+    int     runs    {0};
+    quint64 allocs  = allocations.load();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while( runs < options.minRuns || timer.elapsed() < options.minTime )
+    {
+        records += parse( data );
+        runs++;
+    }
+
+    double  seconds = timer.nsecsElapsed() / 1e9;
+    allocs          = allocations.load() - allocs;
+
+    double  bytes   = double( data.size() ) * runs;
+
+    result["bytes"]             = double( data.size() );
+    result["records"]           = double( records / runs );
+    result["runs"]              = runs;
+    result["seconds"]           = seconds;
+    result["mb_per_s"]          = bytes / seconds / 1e6;
+    result["records_per_s"]     = records / seconds;
+    result["allocs_per_record"] = records > 0 ? double( allocs ) / records : 0.0;
+    result["peak_rss_kb"]       = double( peakRss() );
+
+    return result;
+}
+
+bool readFile( const QString &fileName, QByteArray &data )
+{
+    QFile file( fileName );
+
+    if( !file.open( QIODevice::ReadOnly ) )
+    {
+        QTextStream( stderr ) << "Cannot read " << fileName << ": "
+                              << file.errorString() << "\n";
+        return false;
+    }
+    data = file.readAll();
+    return true;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'compare' checks the results against a baseline (a previous output). It   */
+/* returns the number of regressions found.                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+int compare( const QList<QJsonObject> &results,
+             const QString &fileName,
+             double tolerance )
+{
+    QByteArray data;
+
+    if( !readFile( fileName, data ) ) return 1;
+
+    QHash<QString, QJsonObject> baseline;
+
+    for( const QByteArray &line : data.split( '\n' ) )
+    {
+        const QJsonObject o = QJsonDocument::fromJson( line ).object();
+        if( !o.isEmpty() )
+        {
+            baseline.insert( o["parser"].toString() + "/" + o["input"].toString(), o );
+        }
+    }
+
+    int         regressions {0};
+    QTextStream err( stderr );
+
+    for( const QJsonObject &r : results )
+    {
+        const QString key = r["parser"].toString() + "/" + r["input"].toString();
+
+        if( !baseline.contains( key ) ) continue;
+
+        const QJsonObject &b = baseline[key];
+
+        double speed  = r["mb_per_s"].toDouble();
+        double before = b["mb_per_s"].toDouble();
+
+        if( speed < before * ( 1.0 - tolerance / 100.0 ) )
+        {
+            err << "REGRESSION " << key << ": " << speed << " MB/s, was "
+                << before << " MB/s\n";
+            regressions++;
+        }
+
+        double allocs       = r["allocs_per_record"].toDouble();
+        double allocsBefore = b["allocs_per_record"].toDouble();
+
+        if( allocs > allocsBefore * ( 1.0 + tolerance / 100.0 ) + 0.5 )
+        {
+            err << "REGRESSION " << key << ": " << allocs
+                << " allocations per record, was " << allocsBefore << "\n";
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+}
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+    QCoreApplication::setApplicationName( "ncbiquery_bench" );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Benchmark the ncbiquery reply parsers" );
+    parser.addHelpOption();
+
+    QCommandLineOption recordsOption( "records",
+        "Number of records of the synthetic replies (default: 100000).",
+        "n", "100000" );
+    QCommandLineOption lengthOption( "length",
+        "Length of the synthetic sequences (default: 658).", "bases", "658" );
+    QCommandLineOption chunkOption( "chunk",
+        "Size of the chunks fed to incremental parsers (default: 16384).",
+        "bytes", "16384" );
+    QCommandLineOption parserOption( "parser",
+        "Run only <name>: esearch, efetch, fasta or summary.", "name" );
+    QCommandLineOption fixturesOption( "fixtures",
+        "Directory of the recorded replies.", "directory",
+        NCBIQUERY_BENCH_FIXTURES );
+    QCommandLineOption minTimeOption( "min-time",
+        "Minimum time spent on every measurement (default: 500).", "ms", "500" );
+    QCommandLineOption compareOption( "compare",
+        "Compare the results with a previous output in <file>.", "file" );
+    QCommandLineOption toleranceOption( "tolerance",
+        "Change tolerated by --compare, in percent (default: 10).",
+        "percent", "10" );
+    QCommandLineOption generateOption( "generate",
+        "Write a synthetic reply (esearch, gb-xml, fasta or summary) of "
+        "--records records to the standard output and exit.", "kind" );
+
+    parser.addOption( recordsOption );
+    parser.addOption( lengthOption );
+    parser.addOption( chunkOption );
+    parser.addOption( parserOption );
+    parser.addOption( fixturesOption );
+    parser.addOption( minTimeOption );
+    parser.addOption( compareOption );
+    parser.addOption( toleranceOption );
+    parser.addOption( generateOption );
+
+    parser.process( a );
+
+    ulong   records = parser.value( recordsOption ).toULong();
+    int     length  = parser.value( lengthOption ).toInt();
+
+    options.chunk   = qMax( 1, parser.value( chunkOption ).toInt() );
+    options.minTime = parser.value( minTimeOption ).toLongLong();
+
+    const QList<ulong> gis = Synthetic::gis( 100000000, records );
+
+    QTextStream out( stdout );
+
+    if( parser.isSet( generateOption ) )
+    {
+        const QString kind = parser.value( generateOption );
+        QFile         file;
+        QByteArray    data;
+
+        if( kind == "esearch" )     data = Synthetic::esearch( records, 0, gis, false );
+        else if( kind == "gb-xml" ) data = Synthetic::gbSet( gis, length );
+        else if( kind == "fasta" )  data = Synthetic::fasta( gis, length );
+        else if( kind == "summary" ) data = Synthetic::summary( gis );
+        else
+        {
+            QTextStream( stderr ) << "Unknown kind of reply " << kind << "\n";
+            return 1;
+        }
+
+        file.open( stdout, QIODevice::WriteOnly );
+        file.write( data );
+        return 0;
+    }
+
+    struct Case
+    {
+        QString         parser;
+        QString         fixture;
+        ParseFunction   parse;
+        std::function<QByteArray()> generate;
+    };
+
+    // GenBank XML read for the metadata only, which skips the sequence and
+    // most of the feature table
+
+    Projection metadata;
+    metadata.setFields( Projection::Organism | Projection::Country );
+    metadata.addQualifier( "specimen_voucher" );
+
+    const QList<Case> cases =
+    {
+        { "esearch", "esearch.xml", parseEsearch,
+          [&]() { return Synthetic::esearch( records, 0, gis, false ); } },
+        { "efetch", "gbset.xml",
+          []( const QByteArray &d ) { return parseIncremental( FetchProfile::GbXml, d ); },
+          [&]() { return Synthetic::gbSet( gis, length ); } },
+        { "efetch-metadata", "gbset.xml",
+          [&]( const QByteArray &d ) { return parseIncremental( FetchProfile::GbXml, d,
+                                                                metadata ); },
+          [&]() { return Synthetic::gbSet( gis, length ); } },
+        { "fasta", "sequences.fasta",
+          []( const QByteArray &d ) { return parseIncremental( FetchProfile::Fasta, d ); },
+          [&]() { return Synthetic::fasta( gis, length ); } },
+        { "summary", "esummary.xml",
+          []( const QByteArray &d ) { return parseIncremental( FetchProfile::Summary, d ); },
+          [&]() { return Synthetic::summary( gis ); } }
+    };
+
+    // The parsers print their progress with qDebug
+
+    qInstallMessageHandler( []( QtMsgType, const QMessageLogContext &, const QString & ) {} );
+
+    QList<QJsonObject> results;
+    bool               failed {false};
+
+    for( const Case &c : cases )
+    {
+        if( parser.isSet( parserOption ) && parser.value( parserOption ) != c.parser )
+        {
+            continue;
+        }
+
+        QByteArray data;
+
+        if( readFile( parser.value( fixturesOption ) + "/" + c.fixture, data ) )
+        {
+            results.append( measure( c.parser, "fixture", data, c.parse ) );
+            out << QJsonDocument( results.last() ).toJson( QJsonDocument::Compact ) << Qt::endl;
+        }
+        else
+        {
+            failed = true;
+        }
+
+        if( records > 0 )
+        {
+            data = c.generate();
+            results.append( measure( c.parser, "synthetic", data, c.parse ) );
+            out << QJsonDocument( results.last() ).toJson( QJsonDocument::Compact ) << Qt::endl;
+        }
+    }
+
+    for( const QJsonObject &r : results )
+    {
+        if( r.contains( "error" ) ) failed = true;
+    }
+
+    if( parser.isSet( compareOption ) &&
+        compare( results, parser.value( compareOption ),
+                 parser.value( toleranceOption ).toDouble() ) > 0 )
+    {
+        failed = true;
+    }
+
+    return failed ? 1 : 0;
+}
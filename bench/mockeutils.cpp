@@ -0,0 +1,339 @@
+#include <QRandomGenerator>
+#include <QTcpSocket>
+#include <QPointer>
+#include <QUrlQuery>
+#include <QTimer>
+#include <QUrl>
+
+#include "mockeutils.h"
+#include "synthetic.h"
+
+// A stand-in for NCBI's eutils ('esearch.fcgi', 'epost.fcgi', 'efetch.fcgi'
+// and 'esummary.fcgi') serving a synthetic result set of '_records' records
+// (see 'synthetic.cpp') over plain HTTP/1.1 with keep-alive. It understands
+// the same parameters GbQuery sends: 'retstart'/'retmax' paging, History
+// server keys ('usehistory=y' with 'esearch', or the WebEnv returned by
+// 'epost'), explicit 'id' lists and the 'rettype' of every fetch profile.
+//
+// Faults are injected on purpose: every reply can be delayed by '_latency'
+// milliseconds, a fraction '_throttleRate' of the requests is answered with
+// HTTP 429 (as NCBI does when the rate limit is exceeded), and a fraction
+// '_truncateRate' of the replies is cut in half with a success status (as
+// NCBI sometimes does when overloaded). Replies are compressed with deflate
+// when the client accepts it.
+
+namespace
+{
+
+const QByteArray searchPath     {"/entrez/eutils/esearch.fcgi"};
+const QByteArray postPath       {"/entrez/eutils/epost.fcgi"};
+const QByteArray fetchPath      {"/entrez/eutils/efetch.fcgi"};
+const QByteArray summaryPath    {"/entrez/eutils/esummary.fcgi"};
+
+const QString    searchWebEnv   {"MCID_search"};
+
+QByteArray reason( int status )
+{
+    switch( status )
+    {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 429: return "Too Many Requests";
+        default:  return "Error";
+    }
+}
+
+}
+
+MockEutils::MockEutils( QObject *parent )
+    : QTcpServer( parent )
+{
+    connect( this, &QTcpServer::newConnection,
+             this, &MockEutils::acceptConnection );
+}
+
+MockEutils::~MockEutils()
+{
+}
+
+void MockEutils::setRecords( ulong records )
+{
+    _records = records;
+}
+
+void MockEutils::setLength( int length )
+{
+    _length = length;
+}
+
+void MockEutils::setLatency( int milliseconds )
+{
+    _latency = milliseconds;
+}
+
+void MockEutils::setThrottleRate( double rate )
+{
+    _throttleRate = rate;
+}
+
+void MockEutils::setTruncateRate( double rate )
+{
+    _truncateRate = rate;
+}
+
+void MockEutils::setCompression( bool compression )
+{
+    _compression = compression;
+}
+
+MockEutils::Stats MockEutils::stats()
+{
+    return _stats;
+}
+
+// The GIs of the whole result set, in order
+
+QList<ulong> MockEutils::ids()
+{
+    return Synthetic::gis( _firstGi, _records );
+}
+
+void MockEutils::acceptConnection()
+{
+    while( QTcpSocket *socket = nextPendingConnection() )
+    {
+        _buffers.insert( socket, QByteArray() );
+
+        connect( socket, &QTcpSocket::readyRead,
+                 this,   &MockEutils::readRequest );
+        connect( socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            _buffers.remove( socket );
+            socket->deleteLater();
+        } );
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'readRequest' collects the bytes of a connection and handles every        */
+/* complete request found among them                                         */
+/*                                                                           */
+/*****************************************************************************/
+
+void MockEutils::readRequest()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>( sender() );
+
+    QByteArray &buffer = _buffers[socket];
+    buffer += socket->readAll();
+
+    while( handleRequest( socket, buffer ) )
+    {
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'handleRequest' parses the request at the start of 'buffer' and answers   */
+/* it. It returns false if the request is not complete yet.                  */
+/*                                                                           */
+/*****************************************************************************/
+
+bool MockEutils::handleRequest( QTcpSocket *socket, QByteArray &buffer )
+{
+    qsizetype end = buffer.indexOf( "\r\n\r\n" );
+    if( end < 0 ) return false;
+
+    const QList<QByteArray> lines = buffer.left( end ).split( '\n' );
+    const QList<QByteArray> request = lines.first().trimmed().split( ' ' );
+
+    qsizetype length  {0};
+    bool      deflate {false};
+
+    for( qsizetype i = 1; i < lines.size(); ++i )
+    {
+        const QByteArray line = lines.at( i ).trimmed().toLower();
+
+        if( line.startsWith( "content-length:" ) )
+        {
+            length = line.mid( 15 ).trimmed().toLongLong();
+        }
+        else if( line.startsWith( "accept-encoding:" ) )
+        {
+            deflate = line.contains( "deflate" );
+        }
+    }
+
+    if( buffer.size() < end + 4 + length ) return false;
+
+    const QByteArray body = buffer.mid( end + 4, length );
+    buffer.remove( 0, end + 4 + length );
+
+    if( request.size() < 2 )
+    {
+        respond( socket, 400, QByteArray(), false );
+        return true;
+    }
+
+    const QUrl url( QString::fromLatin1( request.at( 1 ) ) );
+    const QByteArray path = url.path().toLatin1();
+
+    // POST parameters travel in the body
+
+    QUrlQuery query( url );
+    if( request.at( 0 ) == "POST" ) query = QUrlQuery( QString::fromLatin1( body ) );
+
+    if( path == searchPath )        _stats.esearch++;
+    else if( path == postPath )     _stats.epost++;
+    else if( path == fetchPath )    _stats.efetch++;
+    else if( path == summaryPath )  _stats.esummary++;
+    else
+    {
+        respond( socket, 404, QByteArray(), false );
+        return true;
+    }
+
+    if( QRandomGenerator::global()->generateDouble() < _throttleRate )
+    {
+        _stats.throttled++;
+        respond( socket, 429, "{\"error\":\"API rate limit exceeded\"}", false );
+        return true;
+    }
+
+    QByteArray reply;
+
+    if( path == searchPath )        reply = esearch( query );
+    else if( path == postPath )     reply = epost( query );
+    else                            reply = fetch( query, path == summaryPath );
+
+    if( QRandomGenerator::global()->generateDouble() < _truncateRate )
+    {
+        _stats.truncated++;
+        reply.truncate( reply.size() / 2 );
+    }
+
+    respond( socket, 200, reply, deflate && _compression );
+    return true;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'respond' writes a reply, after '_latency' milliseconds if set            */
+/*                                                                           */
+/*****************************************************************************/
+
+void MockEutils::respond( QTcpSocket *socket,
+                          int status,
+                          const QByteArray &body,
+                          bool deflate )
+{
+    QByteArray data = body;
+    QByteArray head = "HTTP/1.1 " + QByteArray::number( status ) + ' ' + reason( status ) + "\r\n";
+
+    // 'qCompress' output is a zlib stream (which is what HTTP calls 'deflate')
+    // after a 4 byte length prefix
+
+    if( deflate )
+    {
+        data = qCompress( body ).mid( 4 );
+        head += "Content-Encoding: deflate\r\n";
+    }
+
+    head += "Content-Type: text/xml; charset=UTF-8\r\n";
+    head += "Content-Length: " + QByteArray::number( data.size() ) + "\r\n";
+    head += "Connection: keep-alive\r\n\r\n";
+
+    _stats.bytes += head.size() + data.size();
+
+    QPointer<QTcpSocket> target( socket );
+    QByteArray           reply = head + data;
+
+    auto write = [target, reply]() {
+        if( target ) target->write( reply );
+    };
+
+    if( _latency > 0 )
+    {
+        QTimer::singleShot( _latency, this, write );
+    }
+    else
+    {
+        write();
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* The endpoints                                                             */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray MockEutils::esearch( const QUrlQuery &query )
+{
+    ulong retStart = query.queryItemValue( "retstart" ).toULong();
+    ulong retMax   = query.queryItemValue( "retmax" ).toULong();
+    bool  history  = query.queryItemValue( "usehistory" ) == "y";
+
+    if( retStart > _records ) retStart = _records;
+    retMax = qMin( retMax, _records - retStart );
+
+    return Synthetic::esearch( _records, retStart,
+                               Synthetic::gis( _firstGi + retStart, retMax ),
+                               history );
+}
+
+QByteArray MockEutils::epost( const QUrlQuery &query )
+{
+    const QString webEnv = "MCID_post" + QString::number( _posted.size() + 1 );
+
+    QList<ulong> ids;
+    const QStringList values = query.queryItemValue( "id" ).split( ',', Qt::SkipEmptyParts );
+    ids.reserve( values.size() );
+    for( const QString &id : values ) ids.append( id.toULong() );
+
+    _posted.insert( webEnv, ids );
+
+    return Synthetic::epost( webEnv, 1 );
+}
+
+// The IDs of a fetch: an explicit 'id' list, or a page of a set stored on the
+// History server
+
+QList<ulong> MockEutils::requestedIds( const QUrlQuery &query )
+{
+    QList<ulong> ids;
+
+    if( query.hasQueryItem( "id" ) )
+    {
+        const QStringList values = query.queryItemValue( "id" ).split( ',', Qt::SkipEmptyParts );
+        ids.reserve( values.size() );
+        for( const QString &id : values ) ids.append( id.toULong() );
+        return ids;
+    }
+
+    const QString webEnv   = query.queryItemValue( "WebEnv" );
+    ulong         retStart = query.queryItemValue( "retstart" ).toULong();
+    ulong         retMax   = query.queryItemValue( "retmax" ).toULong();
+
+    if( webEnv == searchWebEnv )
+    {
+        if( retStart > _records ) retStart = _records;
+        return Synthetic::gis( _firstGi + retStart, qMin( retMax, _records - retStart ) );
+    }
+
+    return _posted.value( webEnv ).mid( retStart, retMax );
+}
+
+QByteArray MockEutils::fetch( const QUrlQuery &query, bool summary )
+{
+    const QList<ulong> ids = requestedIds( query );
+
+    if( summary ) return Synthetic::summary( ids );
+
+    if( query.queryItemValue( "rettype" ) == "fasta" )
+    {
+        return Synthetic::fasta( ids, _length );
+    }
+    return Synthetic::gbSet( ids, _length );
+}
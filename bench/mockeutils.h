@@ -0,0 +1,70 @@
+#ifndef MOCKEUTILS_H
+#define MOCKEUTILS_H
+
+#include <QTcpServer>
+#include <QByteArray>
+#include <QString>
+#include <QHash>
+#include <QList>
+
+class QTcpSocket;
+class QUrlQuery;
+
+class MockEutils : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    struct Stats
+    {
+        qint64          esearch         {0};
+        qint64          efetch          {0};
+        qint64          esummary        {0};
+        qint64          epost           {0};
+        qint64          throttled       {0};
+        qint64          truncated       {0};
+        qint64          bytes           {0};
+    };
+
+    explicit        MockEutils( QObject * parent = nullptr );
+    ~MockEutils();
+    void            setRecords( ulong );
+    void            setLength( int );
+    void            setLatency( int );
+    void            setThrottleRate( double );
+    void            setTruncateRate( double );
+    void            setCompression( bool );
+    Stats           stats();
+    QList<ulong>    ids();
+
+private:
+    ulong           _records        {10000};
+    ulong           _firstGi        {100000000};
+    int             _length         {658};
+    int             _latency        {0};
+    double          _throttleRate   {0.0};
+    double          _truncateRate   {0.0};
+    bool            _compression    {true};
+    Stats           _stats;
+
+    // Bytes received on every connection and not handled yet
+
+    QHash<QTcpSocket *, QByteArray>     _buffers;
+
+    // ID lists uploaded with 'epost', by WebEnv
+
+    QHash<QString, QList<ulong>>        _posted;
+
+    bool            handleRequest( QTcpSocket *, QByteArray & );
+    QByteArray      esearch( const QUrlQuery & );
+    QByteArray      epost( const QUrlQuery & );
+    QByteArray      fetch( const QUrlQuery &, bool );
+    QList<ulong>    requestedIds( const QUrlQuery & );
+    void            respond( QTcpSocket *, int, const QByteArray &, bool );
+
+private slots:
+    void            acceptConnection();
+    void            readRequest();
+};
+
+#endif // MOCKEUTILS_H
@@ -0,0 +1,364 @@
+#include "synthetic.h"
+
+// The records imitate those of the nuccore database for a barcoding marker:
+// a GBSeq with the usual header fields, a reference, a source feature with
+// its qualifiers and a CDS feature with its translation, followed by the
+// sequence. Replies of 100k records and more are built in a single buffer
+// reserved up front.
+
+namespace
+{
+
+const char *organisms[] =
+{
+    "Corophium volutator",
+    "Munna minuta",
+    "Gammarus locusta",
+    "Idotea balthica",
+    "Jaera albifrons"
+};
+
+const char *countries[] =
+{
+    "Norway",
+    "Portugal: Aveiro",
+    "Germany: North Sea, Helgoland",
+    "Iceland",
+    "Scotland"
+};
+
+const int organismCount = sizeof( organisms ) / sizeof( organisms[0] );
+const int countryCount  = sizeof( countries ) / sizeof( countries[0] );
+
+// A small linear congruential generator seeded by the GI
+
+quint32 next( quint32 &state )
+{
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+void appendSequence( QByteArray &out, ulong gi, int length )
+{
+    static const char bases[] = "acgt";
+
+    quint32 state = quint32( gi );
+    for( int i = 0; i < length; ++i ) out.append( bases[ next( state ) & 3 ] );
+}
+
+void appendNumber( QByteArray &out, ulong n )
+{
+    out.append( QByteArray::number( qulonglong( n ) ) );
+}
+
+const char *organism( ulong gi )
+{
+    return organisms[ gi % organismCount ];
+}
+
+const char *country( ulong gi )
+{
+    return countries[ ( gi / organismCount ) % countryCount ];
+}
+
+void appendQualifier( QByteArray &out, const char *name, const QByteArray &value )
+{
+    out.append( "            <GBQualifier>\n"
+                "              <GBQualifier_name>" );
+    out.append( name );
+    out.append( "</GBQualifier_name>\n"
+                "              <GBQualifier_value>" );
+    out.append( value );
+    out.append( "</GBQualifier_value>\n"
+                "            </GBQualifier>\n" );
+}
+
+void appendGbSeq( QByteArray &out, ulong gi, int length )
+{
+    const QByteArray acc = Synthetic::accession( gi ).toLatin1();
+    const QByteArray len = QByteArray::number( length );
+    const QByteArray org = organism( gi );
+
+    out.append( "  <GBSeq>\n    <GBSeq_locus>" );
+    out.append( acc.chopped( 2 ) );
+    out.append( "</GBSeq_locus>\n    <GBSeq_length>" );
+    out.append( len );
+    out.append( "</GBSeq_length>\n"
+                "    <GBSeq_strandedness>single</GBSeq_strandedness>\n"
+                "    <GBSeq_moltype>DNA</GBSeq_moltype>\n"
+                "    <GBSeq_topology>linear</GBSeq_topology>\n"
+                "    <GBSeq_division>INV</GBSeq_division>\n"
+                "    <GBSeq_update-date>23-JUL-2016</GBSeq_update-date>\n"
+                "    <GBSeq_create-date>23-JUL-2016</GBSeq_create-date>\n"
+                "    <GBSeq_definition>" );
+    out.append( org );
+    out.append( " voucher MT" );
+    appendNumber( out, gi % 100000 );
+    out.append( " cytochrome oxidase subunit I (COI) gene, partial cds; "
+                "mitochondrial</GBSeq_definition>\n"
+                "    <GBSeq_primary-accession>" );
+    out.append( acc.chopped( 2 ) );
+    out.append( "</GBSeq_primary-accession>\n    <GBSeq_accession-version>" );
+    out.append( acc );
+    out.append( "</GBSeq_accession-version>\n"
+                "    <GBSeq_other-seqids>\n      <GBSeqid>gb|" );
+    out.append( acc );
+    out.append( "|</GBSeqid>\n      <GBSeqid>gi|" );
+    appendNumber( out, gi );
+    out.append( "</GBSeqid>\n    </GBSeq_other-seqids>\n"
+                "    <GBSeq_source>mitochondrion " );
+    out.append( org );
+    out.append( "</GBSeq_source>\n    <GBSeq_organism>" );
+    out.append( org );
+    out.append( "</GBSeq_organism>\n"
+                "    <GBSeq_taxonomy>Eukaryota; Metazoa; Ecdysozoa; Arthropoda; "
+                "Crustacea; Multicrustacea; Malacostraca; Eumalacostraca; "
+                "Peracarida</GBSeq_taxonomy>\n"
+                "    <GBSeq_references>\n"
+                "      <GBReference>\n"
+                "        <GBReference_reference>1</GBReference_reference>\n"
+                "        <GBReference_position>1..." );
+    out.append( len );
+    out.append( "</GBReference_position>\n"
+                "        <GBReference_authors>\n"
+                "          <GBAuthor>Lobo,J.</GBAuthor>\n"
+                "          <GBAuthor>Costa,F.O.</GBAuthor>\n"
+                "        </GBReference_authors>\n"
+                "        <GBReference_title>DNA barcoding of marine "
+                "peracarids</GBReference_title>\n"
+                "        <GBReference_journal>Unpublished</GBReference_journal>\n"
+                "      </GBReference>\n"
+                "    </GBSeq_references>\n"
+                "    <GBSeq_feature-table>\n"
+                "      <GBFeature>\n"
+                "        <GBFeature_key>source</GBFeature_key>\n"
+                "        <GBFeature_location>1.." );
+    out.append( len );
+    out.append( "</GBFeature_location>\n"
+                "        <GBFeature_quals>\n" );
+    appendQualifier( out, "organism", org );
+    appendQualifier( out, "organelle", "mitochondrion" );
+    appendQualifier( out, "mol_type", "genomic DNA" );
+    appendQualifier( out, "specimen_voucher", "MT" + QByteArray::number( qulonglong( gi % 100000 ) ) );
+    appendQualifier( out, "db_xref", "taxon:" + QByteArray::number( qulonglong( 1000 + gi % organismCount ) ) );
+    appendQualifier( out, "country", country( gi ) );
+    out.append( "        </GBFeature_quals>\n"
+                "      </GBFeature>\n"
+                "      <GBFeature>\n"
+                "        <GBFeature_key>CDS</GBFeature_key>\n"
+                "        <GBFeature_location>&lt;1..&gt;" );
+    out.append( len );
+    out.append( "</GBFeature_location>\n"
+                "        <GBFeature_quals>\n" );
+    appendQualifier( out, "gene", "COI" );
+    appendQualifier( out, "codon_start", "1" );
+    appendQualifier( out, "transl_table", "5" );
+    appendQualifier( out, "product", "cytochrome oxidase subunit I" );
+    appendQualifier( out, "translation",
+                     QByteArray( "TLYFILGTWSGLVGTSMSMLIRAELGQPGSLIGDDQIYNVIVTAHAFIMIFFMVMPIMIGGFGNWLVPLMLG" )
+                     .left( length / 3 ) );
+    out.append( "        </GBFeature_quals>\n"
+                "      </GBFeature>\n"
+                "    </GBSeq_feature-table>\n"
+                "    <GBSeq_sequence>" );
+    appendSequence( out, gi, length );
+    out.append( "</GBSeq_sequence>\n  </GBSeq>\n" );
+}
+
+}
+
+namespace Synthetic
+{
+
+// 'count' consecutive GIs starting at 'first'
+
+QList<ulong> gis( ulong first, ulong count )
+{
+    QList<ulong> list;
+    list.reserve( count );
+    for( ulong i = 0; i < count; ++i ) list.append( first + i );
+    return list;
+}
+
+QString accession( ulong gi )
+{
+    return QStringLiteral( "SY%1.1" ).arg( gi % 1000000, 6, 10, QLatin1Char( '0' ) );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'esearch' builds a page of a search result of 'count' records starting at */
+/* 'retStart' with the given IDs. With 'history' the result set is said to   */
+/* be stored on the History server.                                          */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray esearch( ulong count, ulong retStart, const QList<ulong> &ids, bool history )
+{
+    QByteArray out;
+    out.reserve( 512 + ids.size() * 24 );
+
+    out.append( "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+                "<!DOCTYPE eSearchResult PUBLIC \"-//NLM//DTD esearch 20060628//EN\" "
+                "\"https://eutils.ncbi.nlm.nih.gov/eutils/dtd/20060628/esearch.dtd\">\n"
+                "<eSearchResult><Count>" );
+    appendNumber( out, count );
+    out.append( "</Count><RetMax>" );
+    appendNumber( out, ids.size() );
+    out.append( "</RetMax><RetStart>" );
+    appendNumber( out, retStart );
+    out.append( "</RetStart>" );
+    if( history )
+    {
+        out.append( "<QueryKey>1</QueryKey><WebEnv>MCID_search</WebEnv>" );
+    }
+    out.append( "<IdList>\n" );
+    for( const ulong gi : ids )
+    {
+        out.append( "<Id>" );
+        appendNumber( out, gi );
+        out.append( "</Id>\n" );
+    }
+    out.append( "</IdList><TranslationSet><Translation>"
+                "<From>Synthetic[organism]</From>"
+                "<To>\"Synthetic\"[Organism]</To>"
+                "</Translation></TranslationSet>"
+                "<TranslationStack><TermSet><Term>\"Synthetic\"[Organism]</Term>"
+                "<Field>Organism</Field><Count>" );
+    appendNumber( out, count );
+    out.append( "</Count><Explode>Y</Explode></TermSet><OP>GROUP</OP>"
+                "</TranslationStack>"
+                "<QueryTranslation>\"Synthetic\"[Organism]</QueryTranslation>"
+                "</eSearchResult>\n" );
+    return out;
+}
+
+QByteArray epost( const QString &webEnv, ulong queryKey )
+{
+    QByteArray out;
+
+    out.append( "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+                "<!DOCTYPE ePostResult PUBLIC \"-//NLM//DTD epost 20090526//EN\" "
+                "\"https://eutils.ncbi.nlm.nih.gov/eutils/dtd/20090526/epost.dtd\">\n"
+                "<ePostResult>\n\t<QueryKey>" );
+    appendNumber( out, queryKey );
+    out.append( "</QueryKey>\n\t<WebEnv>" );
+    out.append( webEnv.toLatin1() );
+    out.append( "</WebEnv>\n</ePostResult>\n" );
+    return out;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'gbSet' builds an 'efetch' reply in GenBank XML with a record of 'length' */
+/* bases for every GI                                                        */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray gbSet( const QList<ulong> &ids, int length )
+{
+    QByteArray out;
+    out.reserve( 256 + ids.size() * ( 4200 + length ) );
+
+    out.append( "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+                "<!DOCTYPE GBSet PUBLIC \"-//NCBI//NCBI GBSeq/EN\" "
+                "\"https://www.ncbi.nlm.nih.gov/dtd/NCBI_GBSeq.dtd\">\n"
+                "<GBSet>\n" );
+    for( const ulong gi : ids ) appendGbSeq( out, gi, length );
+    out.append( "</GBSet>\n" );
+    return out;
+}
+
+QByteArray fasta( const QList<ulong> &ids, int length )
+{
+    QByteArray out;
+    out.reserve( ids.size() * ( 160 + length + length / 70 + 1 ) );
+
+    for( const ulong gi : ids )
+    {
+        out.append( '>' );
+        out.append( accession( gi ).toLatin1() );
+        out.append( ' ' );
+        out.append( organism( gi ) );
+        out.append( " voucher MT" );
+        appendNumber( out, gi % 100000 );
+        out.append( " cytochrome oxidase subunit I (COI) gene, partial cds; "
+                    "mitochondrial\n" );
+
+        QByteArray sequence;
+        appendSequence( sequence, gi, length );
+        sequence = sequence.toUpper();
+        for( qsizetype i = 0; i < sequence.size(); i += 70 )
+        {
+            out.append( sequence.mid( i, 70 ) );
+            out.append( '\n' );
+        }
+        out.append( '\n' );
+    }
+    return out;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'summary' builds an 'esummary' (version 2.0) reply                        */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray summary( const QList<ulong> &ids )
+{
+    QByteArray out;
+    out.reserve( 256 + ids.size() * 1200 );
+
+    out.append( "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+                "<eSummaryResult>\n"
+                "<DocumentSummarySet status=\"OK\">\n"
+                "<DbBuild>Build230721-1955m.1</DbBuild>\n" );
+    for( const ulong gi : ids )
+    {
+        const QByteArray acc = accession( gi ).toLatin1();
+
+        out.append( "<DocumentSummary uid=\"" );
+        appendNumber( out, gi );
+        out.append( "\">\n\t<Caption>" );
+        out.append( acc.chopped( 2 ) );
+        out.append( "</Caption>\n\t<Title>" );
+        out.append( organism( gi ) );
+        out.append( " cytochrome oxidase subunit I (COI) gene, partial cds; "
+                    "mitochondrial</Title>\n\t<Extra>gi|" );
+        appendNumber( out, gi );
+        out.append( "|gb|" );
+        out.append( acc );
+        out.append( "|</Extra>\n\t<Gi>" );
+        appendNumber( out, gi );
+        out.append( "</Gi>\n"
+                    "\t<CreateDate>2016/07/23</CreateDate>\n"
+                    "\t<UpdateDate>2016/07/23</UpdateDate>\n"
+                    "\t<Flags>0</Flags>\n"
+                    "\t<TaxId>1000</TaxId>\n"
+                    "\t<Slen>658</Slen>\n"
+                    "\t<Biomol>genomic</Biomol>\n"
+                    "\t<MolType>dna</MolType>\n"
+                    "\t<Topology>linear</Topology>\n"
+                    "\t<SourceDb>insd</SourceDb>\n"
+                    "\t<Genome>mitochondrion</Genome>\n"
+                    "\t<SubType>specimen_voucher|country</SubType>\n"
+                    "\t<SubName>MT" );
+        appendNumber( out, gi % 100000 );
+        out.append( '|' );
+        out.append( country( gi ) );
+        out.append( "</SubName>\n"
+                    "\t<GeneticCode>5</GeneticCode>\n"
+                    "\t<Organism>" );
+        out.append( organism( gi ) );
+        out.append( "</Organism>\n"
+                    "\t<Strain></Strain>\n"
+                    "\t<BioSample></BioSample>\n"
+                    "\t<AccessionVersion>" );
+        out.append( acc );
+        out.append( "</AccessionVersion>\n</DocumentSummary>\n" );
+    }
+    out.append( "</DocumentSummarySet>\n</eSummaryResult>\n" );
+    return out;
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QList>
+
+// Synthetic eutils replies of any size. Every record is a function of its GI
+// only (accession, organism, country and sequence), so the same GI always
+// yields the same record whatever the reply it appears in.
+
+namespace Synthetic
+{
+
+QList<ulong>    gis( ulong, ulong );
+QString         accession( ulong );
+
+QByteArray      esearch( ulong, ulong, const QList<ulong> &, bool );
+QByteArray      epost( const QString &, ulong );
+QByteArray      gbSet( const QList<ulong> &, int );
+QByteArray      fasta( const QList<ulong> &, int );
+QByteArray      summary( const QList<ulong> & );
+
+}
+
+#endif // SYNTHETIC_H
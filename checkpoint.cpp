@@ -0,0 +1,160 @@
+#include <QDebug>
+
+#include "checkpoint.h"
+
+// A 'Checkpoint' records the units of work of a long query that are done, so
+// that an interrupted run resumes where it stopped instead of starting over.
+// A unit is a page of the result set or a slice of a list of GIs, identified
+// by a key such as "page:4000" (see 'GbQuery::finishUnit'). A unit is only
+// marked as done once all its records have been written and the output has
+// been flushed, so the checkpoint also records the size of the output at that
+// point. A resumed run truncates the output back to that size, dropping the
+// records of units that were still in flight.
+//
+// The file is plain text, appended to and flushed after every unit, so that
+// a killed process loses at most the line being written:
+//
+// ncbiquery-checkpoint 1
+// query 9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08
+// done page:0 210331
+// done page:500 421007
+// ...
+//
+// The 'query' line identifies the run by a hash of the parameters of its
+// query and output (see 'main.cpp'). A checkpoint left by a different run is
+// discarded.
+
+namespace
+{
+
+const QByteArray magic {"ncbiquery-checkpoint 1"};
+
+}
+
+Checkpoint::Checkpoint( const QString &fileName, const QString &identity )
+{
+    _file.setFileName( fileName );
+
+    if( load( identity ) )
+    {
+        qDebug() << "Resuming from checkpoint:" << _done.size() << "units done";
+        return;
+    }
+
+    // Start a new checkpoint
+
+    _done.clear();
+    _outputSize = 0;
+
+    if( !_file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        _errorMessage = "Cannot write checkpoint: " + _file.errorString();
+        _error = true;
+        return;
+    }
+
+    _file.write( magic + "\nquery " + identity.toUtf8() + "\n" );
+    _file.flush();
+}
+
+Checkpoint::~Checkpoint()
+{
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'load' reads an existing checkpoint left by the same run. A torn last     */
+/* line (from a process killed while writing it) is cut off. It returns true */
+/* if the checkpoint is reopened for appending.                              */
+/*                                                                           */
+/*****************************************************************************/
+
+bool Checkpoint::load( const QString &identity )
+{
+    if( !_file.exists() || !_file.open( QIODevice::ReadOnly ) ) return false;
+
+    const QByteArray contents = _file.readAll();
+    _file.close();
+
+    const QByteArray header = magic + "\nquery " + identity.toUtf8() + "\n";
+
+    if( !contents.startsWith( header ) ) return false;
+
+    qsizetype start = header.size();
+    qsizetype end;
+
+    while( ( end = contents.indexOf( '\n', start ) ) >= 0 )
+    {
+        const QList<QByteArray> fields = contents.mid( start, end - start ).split( ' ' );
+
+        bool   ok   {false};
+        qint64 size {0};
+
+        if( fields.size() == 3 && fields.at( 0 ) == "done" )
+        {
+            size = fields.at( 2 ).toLongLong( &ok );
+        }
+        if( !ok ) break;
+
+        _done.insert( QString::fromUtf8( fields.at( 1 ) ) );
+        _outputSize = size;
+        start = end + 1;
+    }
+
+    if( !_file.open( QIODevice::ReadWrite ) ) return false;
+
+    _file.resize( start );
+    _file.seek( start );
+    return true;
+}
+
+bool Checkpoint::resuming()
+{
+    return !_done.isEmpty();
+}
+
+// Size of the output when the last unit was marked as done
+
+qint64 Checkpoint::outputSize()
+{
+    return _outputSize;
+}
+
+bool Checkpoint::isDone( const QString &key )
+{
+    return _done.contains( key );
+}
+
+void Checkpoint::markDone( const QString &key, qint64 outputSize )
+{
+    if( _error ) return;
+
+    _done.insert( key );
+    _outputSize = outputSize;
+
+    _file.write( "done " + key.toUtf8() + ' ' + QByteArray::number( outputSize ) + '\n' );
+    if( !_file.flush() )
+    {
+        _errorMessage = "Cannot write checkpoint: " + _file.errorString();
+        _error = true;
+        qDebug() << _errorMessage;
+    }
+}
+
+// A finished run does not need its checkpoint anymore
+
+void Checkpoint::remove()
+{
+    _file.close();
+    _file.remove();
+}
+
+bool Checkpoint::hasError()
+{
+    return _error;
+}
+
+QString Checkpoint::errorMessage()
+{
+    return _errorMessage;
+}
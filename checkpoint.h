@@ -0,0 +1,30 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <QString>
+#include <QFile>
+#include <QSet>
+
+class Checkpoint
+{
+    QFile               _file;
+    QSet<QString>       _done;
+    qint64              _outputSize     {0};
+    bool                _error          {false};
+    QString             _errorMessage   {"No error in checkpoint"};
+
+    bool                load( const QString & );
+
+public:
+    Checkpoint( const QString &, const QString & );
+    ~Checkpoint();
+    bool            resuming();
+    qint64          outputSize();
+    bool            isDone( const QString & );
+    void            markDone( const QString &, qint64 );
+    void            remove();
+    bool            hasError();
+    QString         errorMessage();
+};
+
+#endif // CHECKPOINT_H
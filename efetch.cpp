@@ -1,16 +1,85 @@
-#include <QXmlStreamReader>
-#include <QStringList>
+
 #include <QDebug>
 
 #include "efetch.h"
+#include "nucleotides.h"
+
+// An 'Efetch' object is an incremental parser. The reply to an 'efetch' query
+// is fed to it with 'addData()' as soon as bytes arrive from the network
+// (QXmlStreamReader accepts raw UTF-8, so no UTF-16 copy of the whole reply
+// is ever made). Whenever QXmlStreamReader runs out of data it stops with a
+// 'PrematureEndOfDocumentError' which is not a real error: parsing resumes
+// from the same point when more data is added. Only when 'finish()' is called
+// (i.e., the reply is complete) an incomplete document is reported as an
+// error.
+//
+// Because parsing may stop at any point, we cannot use convenience functions
+// such as 'readElementText()' which expect the whole element to be available.
+// Instead, the parser remembers which element it is in ('_field') and
+// accumulates the text of <Characters> tokens until the respective end
+// element is reached. Each complete <GBSeq> is handed to the record handler
+// right away, so memory is bounded by one record and not by the whole reply.
+//
+// Most of a <GBSeq> is of no interest: the references, the taxonomy, and the
+// features other than "source" (a CDS with its translation, for example).
+// Only the subtrees that may hold a field of the 'Projection' are visited;
+// the others are skipped. 'skipCurrentElement()' cannot be used for this,
+// since it would stop halfway through a subtree when the data runs out and
+// parsing could not tell where it was when it resumes. Instead '_skipDepth'
+// counts the elements open in the subtree being skipped, and tokens are
+// dropped without any lookup until it is closed.
 
-bool Efetch::parseXML(const QByteArray http_response )
+/*****************************************************************************/
+/*                                                                           */
+/* 'wanted' tells whether the element just opened may hold a field of the    */
+/* projection                                                                */
+/*                                                                           */
+/*****************************************************************************/
+
+bool Efetch::wanted( XmlTags::Tag tag )
 {
-    QString _elementname    {""};
-    bool    _xmlerror       {false};
+    if( tag == XmlTags::Tag::GBSeq || _recordDepth < 0 ) return true;
+
+    // Children of <GBSeq>
+
+    if( _depth == _recordDepth + 1 )
+    {
+        switch( tag )
+        {
+            case XmlTags::Tag::GBSeqAccessionVersion:
+            case XmlTags::Tag::GBSeqOtherSeqids:
+                return true;
+            case XmlTags::Tag::GBSeqSequence:
+                return _projection.wants( Projection::Sequence );
+            case XmlTags::Tag::GBSeqFeatureTable:
+                return _projection.needsQualifiers();
+            default:
+                return false;
+        }
+    }
+
+    // Children of <GBFeature> (the only subtree kept this deep): its key and
+    // its qualifiers, but not its location or intervals
+
+    if( _depth == _recordDepth + 3 )
+    {
+        return tag == XmlTags::Tag::GBFeatureKey || tag == XmlTags::Tag::GBFeatureQuals;
+    }
+
+    return true;
+}
 
-    QXmlStreamReader    _xml( QString::fromUtf8( http_response ) );
+// Skip the rest of the element that is open, once it is known that it holds
+// nothing of interest (a feature other than "source", for example)
 
+void Efetch::skipRest()
+{
+    _skipDepth = 1;
+    _depth--;
+}
+
+void Efetch::parseXML()
+{
     // We retreive the full Genbank record in XML format because, apart from
     // the sequence itself and the accession number, there are many attributes
     // that may be of interest for the sequence list, namely the voucher
@@ -27,12 +96,10 @@ bool Efetch::parseXML(const QByteArray http_response )
     // the tag, such as <GBSeq_sequence> (the tag for a sequence). For example,
     // the name of the organism is on a <GBQualifier> which has a subtype
     // <GBQualifier_name> with value "organism". The name of the organism
-    // itself is on the other subtype <GBQualifier_value>. Whenever we read a
-    // <GBQualifier_name> we store it on QString 'qualname'. Then, within the
-    // while loop we advance for the next element with a call to
-    // 'xml.readNextStartElement()'. If the XML is well formed the next element
-    // should be a <GBQualifier_value>, so we store its value on the respective
-    // variable.
+    // itself is on the other subtype <GBQualifier_value>. Whenever we finish
+    // reading a <GBQualifier_name> we store its tag on '_qualifier'. If the
+    // XML is well formed the next element should be a <GBQualifier_value>, so
+    // when it ends we store its value on the respective field.
     //
     // The other elements of interest are
     //
@@ -40,104 +107,205 @@ bool Efetch::parseXML(const QByteArray http_response )
     //
     // but their values can be read directly because their name is clearly
     // depicted on the tag name, not as the value of a subtype!
+    //
+    // Qualifiers are only read from the "source" feature, which describes the
+    // specimen. Qualifiers not in the projection are skipped as soon as their
+    // name is known.
 
-
-    while ( !_xml.atEnd() && !_xml.hasError() )
+    while ( !_xml.atEnd() )
     {
         _xml.readNext();
 
-        // The element name returned by xml.name() after a call to the function
-        // xml.readNext() is a UTF16 encoded QStringView. It is better to
-        // transform it into a standard QString for subsequent comparisons with
-        // string literals
+        // Stop if we ran out of data (or hit a real error). In the first case
+        // parsing will resume once 'addData' is called again
 
-        _elementname = _xml.name().toString();
+        if( _xml.hasError() ) break;
 
-        // Check if we are reading a Start Element
+        // Inside a skipped subtree only its nesting is followed
 
-        if( _xml.isStartElement() )
+        if( _skipDepth > 0 )
         {
-            // qDebug() << _elementname.toStdString();
+            if( _xml.isStartElement() )     _skipDepth++;
+            else if( _xml.isEndElement() )  _skipDepth--;
+            continue;
+        }
 
-            if( _elementname == "GBSeq" )
-            {
-                // Every record in a <GBset> (Genbank XML response) is included
-                // in a <GBSeq></GBSeq> pair of tags. For each new record, we
-                // should clear the respective attribute fields
+        // The element name returned by xml.name() after a call to the function
+        // xml.readNext() is a UTF16 encoded QStringView. Instead of turning it
+        // into a QString (an allocation per element, millions of them for a
+        // large <GBSet>) it is looked up directly in the table of tags we care
+        // about (see 'xmltags.h')
 
-                // qDebug() << "\n--------------";
+        if( _xml.isStartElement() )
+        {
+            const XmlTags::Tag tag = XmlTags::lookup( _xml.name() );
 
-                _records++;
-            }
-            else if ( _elementname == "GBSeq_sequence" )
+            _depth++;
+
+            if( !wanted( tag ) )
             {
-                // This element represents a true sequence
-                QString sequence = _xml.readElementText();
-                // qDebug() << "Sequence: " << sequence.toStdString();
+                skipRest();
+                continue;
             }
-            else if ( _elementname == "GBSeq_accession-version")
+
+            switch( tag )
             {
-                // This element holds the accession number + version
-                // of the sequence in <GBSeq_sequence>
-                QString accession = _xml.readElementText();
-                // qDebug() << "Accession: " << accession.toStdString();
+                case XmlTags::Tag::GBSeq:
+                    // Every record in a <GBset> (Genbank XML response) is
+                    // included in a <GBSeq></GBSeq> pair of tags. For each new
+                    // record, we should clear the respective attribute fields
+                    _record.clear();
+                    _record.qualifiers.resize( _projection.qualifiers().size() );
+                    _recordDepth = _depth;
+                    break;
+                case XmlTags::Tag::GBSeqSequence:
+                    // This element represents a true sequence
+                    _field = Sequence;
+                    break;
+                case XmlTags::Tag::GBSeqAccessionVersion:
+                    // This element holds the accession number + version
+                    // of the sequence in <GBSeq_sequence>
+                    _field = Accession;
+                    break;
+                case XmlTags::Tag::GBSeqid:
+                    _field = SeqId;
+                    _text.resize( 0 );
+                    break;
+                case XmlTags::Tag::GBFeatureKey:
+                    _field = FeatureKey;
+                    _text.resize( 0 );
+                    break;
+                case XmlTags::Tag::GBQualifierName:
+                    _field = QualifierName;
+                    _text.resize( 0 );
+                    break;
+                case XmlTags::Tag::GBQualifierValue:
+                    _field = QualifierValue;
+                    _text.resize( 0 );
+                    break;
+                default:
+                    break;
             }
-            else if( _elementname == "GBSeqid" )
+        }
+        else if( _xml.isCharacters() )
+        {
+            // The text of an element may arrive split in several <Characters>
+            // tokens, so it is always appended
+
+            switch( _field )
             {
-                // There are two <GBSeqid> tags by record enclosed inside a
-                // <GBSeq_other-seqids> tag. One has content of the form
-                // "gb|KU530525.1|", that is, its an accession number. We
-                // already got it from <GBSeq_accession-version>. The other is
-                // of form: "gi|1040737823" and is the only field where we can
-                // get the UID (or GID) of the record. So check if the begining
-                // of string  is "gi" and split it using "|"
-
-                QString qualname = _xml.readElementText();
-                QStringList list = qualname.split('|');
-                QString gi {""};
-                if( list[0] == "gi" )
-                {
-                    gi = list[1];
-                    qDebug() << "GI: " << gi.toStdString();
-                }
+                case Sequence:
+                    // Sequences come in lines of lowercase bases separated by
+                    // white space. Keep only the bases, one byte each, and
+                    // count them.
+                    Nucleotides::append( _record.sequence, _xml.text(), _record.bases );
+                    break;
+                case Accession:
+                    _record.accession += _xml.text();
+                    break;
+                case SeqId:
+                case FeatureKey:
+                case QualifierName:
+                case QualifierValue:
+                    _text += _xml.text();
+                    break;
+                case None:
+                    break;
             }
-            else if( _elementname == "GBQualifier_name" )
-            {
-                // A <GBQualifier> tag has always two subtags: one called
-                // <GBQualifier_name> and the other named <GBQualifier_value>,
-                // by that order. So, if we hit a <GBQualifier_name> we should
-                // check its value by reading the next element. First read the
-                // <GBQualifier_name> inner text.
+        }
+        else if( _xml.isEndElement() )
+        {
+            _depth--;
 
-                QString qualname = _xml.readElementText();
+            switch( _field )
+            {
+                case SeqId:
+                    // There are two <GBSeqid> tags by record enclosed inside a
+                    // <GBSeq_other-seqids> tag. One has content of the form
+                    // "gb|KU530525.1|", that is, its an accession number. We
+                    // already got it from <GBSeq_accession-version>. The other
+                    // is of form: "gi|1040737823" and is the only field where
+                    // we can get the UID (or GID) of the record. So check if
+                    // the begining of string is "gi|" and read the rest
+                    if( QStringView( _text ).startsWith( u"gi|" ) )
+                    {
+                        _record.gi = QStringView( _text ).mid( 3 ).toULong();
+                        // qDebug() << "GI: " << _record.gi;
+                    }
+                    break;
+                case FeatureKey:
+                    // Only the "source" feature has qualifiers of interest
+                    if( XmlTags::lookup( _text ) != XmlTags::Tag::Source )
+                    {
+                        skipRest();
+                    }
+                    break;
+                case QualifierName:
+                    // Qualifier names are looked up in the same table as
+                    // element names, and among the extra qualifiers of the
+                    // projection
+                    _qualifier      = XmlTags::lookup( _text );
+                    _qualifierIndex = _projection.qualifier( _text );
 
-                // Read the next element which should be a <GBQualifier_value>
-                // and grab its value
+                    if( !( _qualifier == XmlTags::Tag::Organism &&
+                           _projection.wants( Projection::Organism ) ) &&
+                        !( _qualifier == XmlTags::Tag::Country &&
+                           _projection.wants( Projection::Country ) ) )
+                    {
+                        _qualifier = XmlTags::Tag::Unknown;
+                        if( _qualifierIndex < 0 ) skipRest();
+                    }
+                    break;
+                case QualifierValue:
+                    if( _qualifier == XmlTags::Tag::Organism )
+                    {
+                        _record.organism = _text;
+                        // qDebug() << "Organism: " << _record.organism;
+                    }
+                    else if( _qualifier == XmlTags::Tag::Country )
+                    {
+                        _record.country = _text;
+                    }
+                    if( _qualifierIndex >= 0 )
+                    {
+                        // Some qualifiers (such as "db_xref") repeat
+                        QString &value = _record.qualifiers[ _qualifierIndex ];
+                        if( !value.isEmpty() ) value += "; ";
+                        value += _text;
+                    }
+                    break;
+                case Sequence:
+                case Accession:
+                case None:
+                    break;
+            }
+            _field = None;
 
-                _xml.readNextStartElement(); // Skip the close tag element
+            if( XmlTags::lookup( _xml.name() ) == XmlTags::Tag::GBSeq )
+            {
+                // The record is complete. Hand it over right away.
 
-                QString qualvalue = _xml.readElementText();
+                // qDebug() << "Accession: " << _record.accession;
+                // qDebug() << "Sequence: " << _record.sequence;
 
-                if( qualname == "organism" )
-                {
-                    QString organism = qualvalue;
-                    // qDebug() << "Organism: " << organism.toStdString();
-                }
+                emitRecord( _record );
             }
         }
     }
-    if ( _xml.hasError() )
-    {
-        _errorMessage = "XML parse error: " + _xml.errorString();
-        _xmlerror = true;
-    }
-    return _xmlerror;
+}
+
+Efetch::Efetch()
+{
+    _errorMessage = "No error parsing XML source";
+    qDebug() << "Constructing EFetch";
 }
 
 Efetch::Efetch( const QByteArray http_response )
 {
+    _errorMessage = "No error parsing XML source";
     qDebug() << "Constructing EFetch";
-    _error = parseXML( http_response );
+    addData( http_response );
+    finish();
 }
 
 Efetch::~Efetch()
@@ -145,17 +313,47 @@ Efetch::~Efetch()
     qDebug() << "Destructing EFetch";
 }
 
-bool Efetch::hasError()
-{
-    return _error;
-}
+/*****************************************************************************/
+/*                                                                           */
+/* 'addData' feeds a new chunk of the reply to the parser and parses as far  */
+/* as the data received so far allows.                                       */
+/*                                                                           */
+/*****************************************************************************/
 
-QString Efetch::errorMessage()
+void Efetch::addData( const QByteArray &chunk )
 {
-    return _errorMessage;
+    if( _error ) return;
+
+    _xml.addData( chunk );
+    parseXML();
+
+    if( _xml.hasError() &&
+        _xml.error() != QXmlStreamReader::PrematureEndOfDocumentError )
+    {
+        _errorMessage = "XML parse error: " + _xml.errorString();
+        _error = true;
+    }
 }
 
-ulong Efetch::fetchedRecords()
+/*****************************************************************************/
+/*                                                                           */
+/* 'finish' is called when the whole reply has been fed to the parser. At    */
+/* this point running out of data means the document is truncated.          */
+/*                                                                           */
+/*****************************************************************************/
+
+void Efetch::finish()
 {
-    return _records;
+    if( _error ) return;
+
+    if( _xml.hasError() )
+    {
+        _errorMessage = "XML parse error: " + _xml.errorString();
+        _error = true;
+    }
+    else if( _xml.tokenType() != QXmlStreamReader::EndDocument )
+    {
+        _errorMessage = "XML parse error: incomplete document";
+        _error = true;
+    }
 }
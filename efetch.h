@@ -1,24 +1,51 @@
 #ifndef EFETCH_H
 #define EFETCH_H
 
+#include <QXmlStreamReader>
 #include <QByteArray>
 #include <QString>
 
-class Efetch
+#include "gbrecord.h"
+#include "recordparser.h"
+#include "xmltags.h"
+
+class Efetch : public RecordParser
 {
-    bool                _error          {false};
-    QString             _errorMessage   {"No error parsing XML source"};
-    ulong               _records        {0};
+    enum Field
+    {
+        None,
+        Sequence,
+        Accession,
+        SeqId,
+        FeatureKey,
+        QualifierName,
+        QualifierValue
+    };
+
+    QXmlStreamReader    _xml;
+    GbRecord            _record;
+    Field               _field          {None};
+    QString             _text           {""};
+    XmlTags::Tag        _qualifier      {XmlTags::Tag::Unknown};
+    qsizetype           _qualifierIndex {-1};
+
+    // Elements open, the level of the current <GBSeq>, and elements open in a
+    // subtree being skipped
 
-    bool                parseXML( const QByteArray );
+    int                 _depth          {0};
+    int                 _recordDepth    {-1};
+    int                 _skipDepth      {0};
+
+    bool                wanted( XmlTags::Tag );
+    void                skipRest();
+    void                parseXML();
 
 public:
+    Efetch();
     Efetch( const QByteArray );
     ~Efetch();
-    bool            hasError();
-    QString         errorMessage();
-    ulong           fetchedRecords();
+    void            addData( const QByteArray & ) override;
+    void            finish() override;
 };
 
 #endif // EFETCH_H
-
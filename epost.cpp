@@ -0,0 +1,85 @@
+#include <QXmlStreamReader>
+#include <QDebug>
+
+#include "epost.h"
+#include "xmltags.h"
+
+// The reply to an 'epost' request is a short XML document with the keys to
+// the uploaded ID set on NCBI's History server:
+//
+// <ePostResult>
+//   <QueryKey>1</QueryKey>
+//   <WebEnv>MCID_6728d2a5f3c8b05e0b0b9b87</WebEnv>
+// </ePostResult>
+//
+// or an <ERROR> element if the upload was rejected.
+
+bool Epost::parseXML( const QByteArray http_response )
+{
+    bool    _xmlerror       {false};
+
+    QXmlStreamReader    _xml( http_response );
+
+    while ( !_xml.atEnd() && !_xml.hasError() )
+    {
+        if( _xml.readNext() != QXmlStreamReader::StartElement ) continue;
+
+        switch( XmlTags::lookup( _xml.name() ) )
+        {
+            case XmlTags::Tag::QueryKey:
+                _queryKey = _xml.readElementText().toULong();
+                break;
+            case XmlTags::Tag::WebEnv:
+                _webEnv = _xml.readElementText();
+                break;
+            case XmlTags::Tag::Error:
+                _errorMessage = "ePost error: " + _xml.readElementText();
+                _xmlerror = true;
+                break;
+            default:
+                break;
+        }
+    }
+    if ( _xml.hasError() )
+    {
+        _errorMessage = "XML parse error: " + _xml.errorString();
+        _xmlerror = true;
+    }
+    else if( !_xmlerror && _webEnv == "" )
+    {
+        _errorMessage = "ePost error: no WebEnv in reply";
+        _xmlerror = true;
+    }
+    return _xmlerror;
+}
+
+Epost::Epost( const QByteArray http_response )
+{
+    qDebug() << "Constructing Epost";
+    _error = parseXML( http_response );
+}
+
+Epost::~Epost()
+{
+    qDebug() << "Destructing Epost";
+}
+
+ulong Epost::queryKey()
+{
+    return  _queryKey;
+}
+
+QString Epost::webEnv()
+{
+    return  _webEnv;
+}
+
+bool Epost::hasError()
+{
+    return _error;
+}
+
+QString Epost::errorMessage()
+{
+    return _errorMessage;
+}
@@ -0,0 +1,25 @@
+#ifndef EPOST_H
+#define EPOST_H
+
+#include <QByteArray>
+#include <QString>
+
+class Epost
+{
+    ulong               _queryKey       {0};
+    QString             _webEnv         {""};
+    bool                _error          {false};
+    QString             _errorMessage   {"No error parsing XML source"};
+
+    bool                parseXML( const QByteArray );
+
+public:
+    Epost( QByteArray );
+    ~Epost();
+    ulong           queryKey();
+    QString         webEnv();
+    bool            hasError();
+    QString         errorMessage();
+};
+
+#endif // EPOST_H
@@ -2,62 +2,71 @@
 #include <QDebug>
 
 #include "esearch.h"
+#include "xmltags.h"
 
 bool Esearch::parseXML(const QByteArray http_response )
 {
-    QString _elementname    {""};
     bool    _xmlerror       {false};
 
-    QXmlStreamReader    _xml( QString::fromUtf8( http_response ) );
+    // QXmlStreamReader reads raw UTF-8, so there is no need to convert the
+    // whole reply into a UTF-16 QString first
+
+    QXmlStreamReader    _xml( http_response );
 
     while ( !_xml.atEnd() && !_xml.hasError() )
     {
         // Read the next XML element. Elements can be of type <StartDocument>
         // ( and <EndDocument>), <DTD>, <StartElement> (and <EndElement>), or
-        // <Characters>.
+        // <Characters>. Only start elements are of interest to us.
 
-        _xml.readNext();
+        if( _xml.readNext() != QXmlStreamReader::StartElement ) continue;
 
         // The element name returned by xml.name() after a call to the function
-        // xml.readNext()is a UTF16 encoded string. It is wise to transform it
-        // into a standard QString for subsequent comparisons with literals
-
-        _elementname = _xml.name().toString();
-
-        // We should break out of the loop when a <TranslationSet>, a
-        // <TranslationStack>, or a <QueryTranslation> top elements are found.
-        // Some inner elements (such as <Count>) are repeated inside these top
-        // level elements and their value may have a differnt meaning. Within
-        // <TranslationStack>, the <Count> element may refer to all occurrences
-        // of the queried organism (without taking into account the marker) or
-        // may refer to all occurrences of the marker (for all organisms)!
-        // We are only interested in <Count>, <RetMax>, <RetStart>, and <Id>
-        // (the latter inside <IdList>).
-
-        if( _elementname ==  "TranslationStack" ||
-            _elementname ==  "TranslationSet"   ||
-            _elementname ==  "QueryTranslation" ) _xml.skipCurrentElement();
-
-        if( _xml.isStartElement() )
+        // xml.readNext() is a UTF16 encoded QStringView. Instead of turning it
+        // into a QString (an allocation per element) it is looked up directly
+        // in the table of tags we care about (see 'xmltags.h')
+
+        switch( XmlTags::lookup( _xml.name() ) )
         {
-            if( _elementname == "Id" )
-            {
+            // We should skip the <TranslationSet>, <TranslationStack>, or
+            // <QueryTranslation> top elements. Some inner elements (such as
+            // <Count>) are repeated inside these top level elements and their
+            // value may have a differnt meaning. Within <TranslationStack>,
+            // the <Count> element may refer to all occurrences of the queried
+            // organism (without taking into account the marker) or may refer
+            // to all occurrences of the marker (for all organisms)! We are
+            // only interested in <Count>, <RetMax>, <RetStart>, and <Id> (the
+            // latter inside <IdList>). When the search was submitted with
+            // 'usehistory=y' the result also carries a <WebEnv> and a
+            // <QueryKey> that identify the result set stored on NCBI's
+            // history server.
+
+            case XmlTags::Tag::TranslationStack:
+            case XmlTags::Tag::TranslationSet:
+            case XmlTags::Tag::QueryTranslation:
+                _xml.skipCurrentElement();
+                break;
+            case XmlTags::Tag::Id:
                 _idList.append( _xml.readElementText().toULong() );
-            }
-            else if( _elementname == "Count" )
-            {
+                break;
+            case XmlTags::Tag::Count:
                 _count = _xml.readElementText().toULong();
-            }
-            else if( _elementname == "RetMax" )
-            {
+                break;
+            case XmlTags::Tag::RetMax:
                 _retmax = _xml.readElementText().toULong();
-            }
-            else if( _elementname == "RetStart" )
-            {
+                break;
+            case XmlTags::Tag::RetStart:
                 _retstart = _xml.readElementText().toULong();
-            }
+                break;
+            case XmlTags::Tag::QueryKey:
+                _queryKey = _xml.readElementText().toULong();
+                break;
+            case XmlTags::Tag::WebEnv:
+                _webEnv = _xml.readElementText();
+                break;
+            default:
+                break;
         }
-
     }
     if ( _xml.hasError() )
     {
@@ -93,6 +102,16 @@ ulong Esearch::retStart()
     return  _retstart;
 }
 
+ulong Esearch::queryKey()
+{
+    return  _queryKey;
+}
+
+QString Esearch::webEnv()
+{
+    return  _webEnv;
+}
+
 bool Esearch::hasError()
 {
     return _error;
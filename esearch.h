@@ -10,6 +10,8 @@ class Esearch
     ulong               _count          {0};
     ulong               _retmax         {0};
     ulong               _retstart       {0};
+    ulong               _queryKey       {0};
+    QString             _webEnv         {""};
     bool                _error          {false};
     QList<ulong>        _idList;
     QString             _errorMessage   {"No error parsing XML source"};
@@ -22,6 +24,8 @@ public:
     ulong           count();
     ulong           retMax();
     ulong           retStart();
+    ulong           queryKey();
+    QString         webEnv();
     bool            hasError();
     QList<ulong>    idList();
     QString         errorMessage();
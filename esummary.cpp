@@ -0,0 +1,150 @@
+#include <QDebug>
+
+#include "esummary.h"
+#include "xmltags.h"
+
+// The compact, metadata only profile uses the 'esummary' endpoint (version
+// 2.0), since 'efetch' has no metadata only format for nuccore. Each record
+// is a <DocumentSummary> of a couple hundred bytes, without sequence, feature
+// table or references:
+//
+// <DocumentSummary uid="936254122">
+//   <Caption>KT209362</Caption>
+//   ...
+//   <SubType>specimen_voucher|country</SubType>
+//   <SubName>MT02430|Norway</SubName>
+//   ...
+//   <AccessionVersion>KT209362.1</AccessionVersion>
+//   <Organism>Corophium volutator</Organism>
+//   ...
+// </DocumentSummary>
+//
+// The GI is the 'uid' attribute. Source qualifiers come as two parallel lists
+// separated by '|': <SubType> holds their names and <SubName> their values.
+// Like 'Efetch', this is an incremental parser fed as bytes arrive.
+
+Esummary::Esummary()
+{
+    qDebug() << "Constructing Esummary";
+    _errorMessage = "No error parsing XML source";
+}
+
+Esummary::~Esummary()
+{
+    qDebug() << "Destructing Esummary";
+}
+
+void Esummary::parseXML()
+{
+    while ( !_xml.atEnd() )
+    {
+        _xml.readNext();
+
+        if( _xml.hasError() ) break;
+
+        if( _xml.isStartElement() )
+        {
+            switch( XmlTags::lookup( _xml.name() ) )
+            {
+                case XmlTags::Tag::DocumentSummary:
+                    _record.clear();
+                    _record.qualifiers.resize( _projection.qualifiers().size() );
+                    _subType.resize( 0 );
+                    _subName.resize( 0 );
+                    _record.gi = _xml.attributes().value( u"uid" ).toULong();
+                    break;
+                case XmlTags::Tag::AccessionVersion:
+                    _field = AccessionVersion;
+                    break;
+                case XmlTags::Tag::SummaryOrganism:
+                    _field = Organism;
+                    break;
+                case XmlTags::Tag::SubType:
+                    _field = SubType;
+                    break;
+                case XmlTags::Tag::SubName:
+                    _field = SubName;
+                    break;
+                default:
+                    break;
+            }
+        }
+        else if( _xml.isCharacters() )
+        {
+            switch( _field )
+            {
+                case AccessionVersion:
+                    _record.accession += _xml.text();
+                    break;
+                case Organism:
+                    _record.organism += _xml.text();
+                    break;
+                case SubType:
+                    _subType += _xml.text();
+                    break;
+                case SubName:
+                    _subName += _xml.text();
+                    break;
+                case None:
+                    break;
+            }
+        }
+        else if( _xml.isEndElement() )
+        {
+            _field = None;
+
+            if( XmlTags::lookup( _xml.name() ) == XmlTags::Tag::DocumentSummary )
+            {
+                // Find the country and the qualifiers of the projection
+                // among the source qualifiers
+
+                const QList<QStringView> types = QStringView( _subType ).split( u'|' );
+                const QList<QStringView> names = QStringView( _subName ).split( u'|' );
+
+                for( qsizetype i = 0; i < types.size() && i < names.size(); ++i )
+                {
+                    if( XmlTags::lookup( types.at( i ) ) == XmlTags::Tag::Country )
+                    {
+                        _record.country = names.at( i ).toString();
+                    }
+
+                    const qsizetype q = _projection.qualifier( types.at( i ) );
+                    if( q >= 0 ) _record.qualifiers[q] = names.at( i ).toString();
+                }
+
+                emitRecord( _record );
+            }
+        }
+    }
+}
+
+void Esummary::addData( const QByteArray &chunk )
+{
+    if( _error ) return;
+
+    _xml.addData( chunk );
+    parseXML();
+
+    if( _xml.hasError() &&
+        _xml.error() != QXmlStreamReader::PrematureEndOfDocumentError )
+    {
+        _errorMessage = "XML parse error: " + _xml.errorString();
+        _error = true;
+    }
+}
+
+void Esummary::finish()
+{
+    if( _error ) return;
+
+    if( _xml.hasError() )
+    {
+        _errorMessage = "XML parse error: " + _xml.errorString();
+        _error = true;
+    }
+    else if( _xml.tokenType() != QXmlStreamReader::EndDocument )
+    {
+        _errorMessage = "XML parse error: incomplete document";
+        _error = true;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef ESUMMARY_H
+#define ESUMMARY_H
+
+#include <QXmlStreamReader>
+#include <QByteArray>
+#include <QString>
+
+#include "gbrecord.h"
+#include "recordparser.h"
+
+class Esummary : public RecordParser
+{
+    enum Field
+    {
+        None,
+        AccessionVersion,
+        Organism,
+        SubType,
+        SubName
+    };
+
+    QXmlStreamReader    _xml;
+    GbRecord            _record;
+    Field               _field          {None};
+    QString             _subType        {""};
+    QString             _subName        {""};
+
+    void                parseXML();
+
+public:
+    Esummary();
+    ~Esummary();
+    void            addData( const QByteArray & ) override;
+    void            finish() override;
+};
+
+#endif // ESUMMARY_H
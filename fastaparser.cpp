@@ -0,0 +1,118 @@
+#include <QDebug>
+
+#include "fastaparser.h"
+#include "nucleotides.h"
+
+// 'efetch' with 'rettype=fasta&retmode=text' returns plain FASTA:
+//
+// >KT209362.1 Corophium volutator voucher MT02430 cytochrome oxidase ...
+// AACTCTTTATTTTATCTTAGGAACTTGGTCCGGATTAGTAGGGACCTCTATAAGAATAATTATTCGAACTGAAT
+// TAAGAGGGCCCGGAAATTTAATTGGTAATGACCAAATTTATAACGTAATTGTGACTGCACACGCTTTTATTATA
+// ...
+//
+// The parser works line by line on the raw bytes. A line split between two
+// chunks is kept in '_partial' until the rest of it arrives. The accession is
+// the first word of the header line. FASTA carries neither the GI nor the
+// qualifiers, so those fields are left empty.
+
+FastaParser::FastaParser()
+{
+    qDebug() << "Constructing FastaParser";
+    _errorMessage = "No error parsing FASTA source";
+}
+
+FastaParser::~FastaParser()
+{
+    qDebug() << "Destructing FastaParser";
+}
+
+void FastaParser::parseLine( const char *line, qsizetype size )
+{
+    if( size > 0 && line[size - 1] == '\r' ) size--;
+    if( size == 0 ) return;
+
+    if( line[0] == '>' )
+    {
+        // A new record starts, so the previous one is complete
+
+        if( _inRecord ) emitRecord( _record );
+
+        _record.clear();
+        _inRecord = true;
+
+        qsizetype end = 1;
+        while( end < size && line[end] != ' ' ) end++;
+        _record.accession = QString::fromLatin1( line + 1, end - 1 );
+    }
+    else if( _inRecord )
+    {
+        Nucleotides::append( _record.sequence, QByteArrayView( line, size ), _record.bases );
+    }
+    else
+    {
+        // Anything before the first header is not FASTA (NCBI reports errors
+        // as text or XML with a successful HTTP status)
+
+        _errorMessage = "FASTA parse error: " +
+                        QString::fromLatin1( line, qMin<qsizetype>( size, 80 ) );
+        _error = true;
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'addData' parses all complete lines received so far                       */
+/*                                                                           */
+/*****************************************************************************/
+
+void FastaParser::addData( const QByteArray &chunk )
+{
+    if( _error ) return;
+
+    qsizetype start = 0;
+    qsizetype end;
+
+    // Complete the line left over from the previous chunk
+
+    if( !_partial.isEmpty() )
+    {
+        end = chunk.indexOf( '\n' );
+        if( end < 0 )
+        {
+            _partial.append( chunk );
+            return;
+        }
+        _partial.append( chunk.constData(), end );
+        parseLine( _partial.constData(), _partial.size() );
+        _partial.resize( 0 );
+        start = end + 1;
+    }
+
+    while( !_error && ( end = chunk.indexOf( '\n', start ) ) >= 0 )
+    {
+        parseLine( chunk.constData() + start, end - start );
+        start = end + 1;
+    }
+
+    if( start < chunk.size() )
+    {
+        _partial.append( chunk.constData() + start, chunk.size() - start );
+    }
+}
+
+void FastaParser::finish()
+{
+    if( _error ) return;
+
+    if( !_partial.isEmpty() )
+    {
+        parseLine( _partial.constData(), _partial.size() );
+        _partial.resize( 0 );
+    }
+
+    if( _inRecord )
+    {
+        emitRecord( _record );
+        _inRecord = false;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef FASTAPARSER_H
+#define FASTAPARSER_H
+
+#include <QByteArray>
+
+#include "gbrecord.h"
+#include "recordparser.h"
+
+class FastaParser : public RecordParser
+{
+    GbRecord            _record;
+    QByteArray          _partial;
+    bool                _inRecord       {false};
+
+    void                parseLine( const char *, qsizetype );
+
+public:
+    FastaParser();
+    ~FastaParser();
+    void            addData( const QByteArray & ) override;
+    void            finish() override;
+};
+
+#endif // FASTAPARSER_H
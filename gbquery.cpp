@@ -1,11 +1,18 @@
 #include <QNetworkReply>
+#include <QRandomGenerator>
+#include <QElapsedTimer>
 #include <QDebug>
-#include <QMutex>
-#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "esearch.h"
-#include "efetch.h"
+#include "recordparser.h"
+#include "epost.h"
 #include "gbquery.h"
+#include "gbrecordstore.h"
+#include "recordsink.h"
+#include "recordcache.h"
+#include "checkpoint.h"
 
 
 
@@ -112,17 +119,108 @@
 //                                    V                     V
 //                                   STOP                  STOP
 //
+// The flow above ships every page of GIs back and forth between 'esearch' and
+// 'efetch'. NCBI offers a better alternative: the History server. If the
+// search is submitted with 'usehistory=y', 'esearch' stores the whole result
+// set on NCBI's side and returns a <WebEnv> string plus a <QueryKey> number
+// that identify it. A single 'esearch' call (with retmax=0, since we do not
+// need the GIs themselves) is then enough, and 'efetch' pages directly over
+// the stored result set with 'query_key', 'WebEnv', 'retstart' and 'retmax'.
+// This is the default mode ('_useHistory'). 'pumpFetches' keeps up to
+// '_fetchWindow' pages queued or in flight, and each page completed in
+// 'processEFetch' lets the next one in, until 'count' records have been
+// requested.
+//
+//                   SLOT GbQuery::searchNCBI( 0 )  (usehistory=y)
+//                                          |
+//                                          V
+//                     SLOT GbQuery::processESearch
+//                        get count, WebEnv, QueryKey
+//                                          |
+//                                          V
+//                            GbQuery::pumpFetches() <-------------
+//                                          |                      |
+//                                          V                      |
+//             GbQuery::fetchFromHistory( retstart ) x window      |
+//                                          |                      |
+//                                          V                      |
+//                     SLOT GbQuery::processEFetch ----------------
+//
+// When the GIs themselves are needed (to serve records from a local cache,
+// or to share them among the queries of a batch) the History server is not
+// used. Even then, searching and fetching are not done in lock step: every
+// 'esearch' page brings thousands of GIs (see 'searchPageSize'), which join
+// '_idQueue', and the next page is requested right away (unless the queue is
+// full, see below). 'pumpFetches' drains the queue in batches sized
+// independently by '_fetchSize', keeping up to '_fetchWindow' of them in
+// flight, so that a few searches feed a saturated fetch pipeline.
+//
+//                     SLOT GbQuery::processESearch ---> search( retstart )
+//                        get count, a page of GIs
+//                                          |
+//                                          V
+//                                      _idQueue
+//                                          |
+//                                          V
+//                            GbQuery::pumpFetches() <-------------
+//                                          |                      |
+//                                          V                      |
+//                GbQuery::fetchGiList( batch ) x window           |
+//                                          |                      |
+//                                          V                      |
+//                     SLOT GbQuery::processEFetch ----------------
+//
+// No request is submitted directly to the QNetworkAccessManager. All of them
+// go through '_scheduler' (see 'scheduler.cpp'), which enforces NCBI's rate
+// limits (3 requests per second, or 10 with an API Key) without blocking the
+// event loop, and keeps several requests in flight at the same time.
+//
+// A request that fails with a transient error (a network error, HTTP 429 or
+// 5xx, or a truncated document) is submitted again after an exponentially
+// growing delay (see 'retry'). Records are fetched in units of work: a page
+// of the result set, or a slice of a list of GIs. When every request of a
+// unit is over, its records are accounted for and, if a 'Checkpoint' is set,
+// the unit is recorded as done, so that an interrupted run can be resumed
+// without fetching it again (see 'finishUnit').
+//
+// Every stage is bounded, so that memory stays flat however large the pull
+// (see 'setLimits'). 'esearch' paging stops while '_idQueue' is full. Replies
+// are read through a small read buffer, and left unread (so that TCP slows
+// the sender down) while too many decoded bytes wait for the parsers. Parsers
+// stop while too many parsed records wait to be delivered (to a slow sink,
+// say). No new fetch is started while either is the case.
+//
 
 GbQuery::GbQuery( QObject *parent )
     : QObject( parent )
 {
-    _manager = new QNetworkAccessManager( this );
+    _scheduler = new Scheduler( this );
+    _scheduler->setMaxInFlight( _fetchWindow );
+    _clock.start();
+    qDebug() << "Constructing GbQuery";
+}
+
+// Several queries may share the same scheduler (and thus the same network
+// access manager, rate limit and in-flight limit). The scheduler is not owned
+// by the query in that case, and its limits are left untouched.
+
+GbQuery::GbQuery( Scheduler *scheduler, QObject *parent )
+    : QObject( parent )
+{
+    _scheduler     = scheduler;
+    _ownsScheduler = false;
+    _clock.start();
     qDebug() << "Constructing GbQuery";
 }
 
 GbQuery::~GbQuery()
 {
     qDebug() << "Destructing GbQuery";
+
+    // Requests still waiting in a shared scheduler are dropped
+
+    if( _scheduler ) _scheduler->cancel( this );
+    qDeleteAll( _queued );
 }
 
 void GbQuery::setQueryParams(const QString organism,
@@ -133,9 +231,221 @@ void GbQuery::setQueryParams(const QString organism,
     _organism   = organism;
     _marker     = marker;
     _apiKey     = key;
-    _searchTerm = organism + "[organism]+AND+" + marker;
+    _searchTerm = searchTerm( organism, marker );
     // qDebug() << "Search term: " << _searchTerm;
     _retMax     = retMaxRecords;
+
+    _searchSize.setLimits( 500, 10000 );
+    _searchSize.setSize( _searchPage );
+    _fetchSize.setSize( _retMax );
+
+    // NCBI allows 10 requests per second with an API Key, 3 otherwise
+
+    if( _ownsScheduler ) _scheduler->setRate( _apiKey != "" ? 10.0 : 3.0 );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setAdaptive' lets the number of records asked for in every request grow  */
+/* or shrink with the latency and size of the replies (see 'batchsizer.cpp') */
+/* starting at the 'retmax' of 'setQueryParams'. Otherwise that 'retmax' is  */
+/* used throughout. With a checkpoint, the units of work keep the size of    */
+/* 'retmax' (so that they match those of the interrupted run) and only the   */
+/* requests within a unit adapt.                                             */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setAdaptive( bool adaptive )
+{
+    _searchSize.setAdaptive( adaptive );
+    _fetchSize.setAdaptive( adaptive );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setEndpoint' points the query at another eutils server (a mirror, or the */
+/* mock server of the load test) instead of NCBI's                           */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setEndpoint( const QString &scheme, const QString &host, int port )
+{
+    _scheme = scheme;
+    _host   = host;
+    _port   = port;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setDateRange' restricts the search to the records whose publication      */
+/* ('pdat') or modification ('mdat') date falls between two days, both       */
+/* included. The shards of a large result set are such ranges (see           */
+/* 'shardplanner.cpp').                                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setDateRange( const QString &type, const QDate &minDate, const QDate &maxDate )
+{
+    _dateType = type;
+    _minDate  = minDate;
+    _maxDate  = maxDate;
+}
+
+// The 'esearch' term of an organism/marker query
+
+QString GbQuery::searchTerm( const QString &organism, const QString &marker )
+{
+    return organism + "[organism]+AND+" + marker;
+}
+
+// The 'esearch' parameters of a date range, or nothing if it is not valid
+
+QString GbQuery::dateRange( const QString &type, const QDate &minDate, const QDate &maxDate )
+{
+    if( !minDate.isValid() || !maxDate.isValid() ) return "";
+
+    return "&datetype=" + type +
+           "&mindate=" + minDate.toString( "yyyy/MM/dd" ) +
+           "&maxdate=" + maxDate.toString( "yyyy/MM/dd" );
+}
+
+void GbQuery::setUseHistory( bool useHistory )
+{
+    _useHistory = useHistory;
+}
+
+void GbQuery::setProfile( FetchProfile profile )
+{
+    _profile = profile;
+}
+
+// The fields extracted from every record (all of them by default)
+
+void GbQuery::setProjection( const Projection &projection )
+{
+    _projection = projection;
+}
+
+// Records that go to the cache are always parsed whole, since later queries
+// may ask for any field. The extra qualifiers of a projection are not part of
+// a whole record, and are not cached: a query that asks for some neither
+// reads nor fills the cache, so that a warm run never loses them.
+
+RecordCache *GbQuery::cache()
+{
+    return _projection.qualifiers().isEmpty() ? _cache : nullptr;
+}
+
+Projection GbQuery::parseProjection()
+{
+    Projection projection = _projection;
+    if( cache() ) projection.setFields( Projection::All );
+    return projection;
+}
+
+void GbQuery::setConcurrency( int requests )
+{
+    _fetchWindow = requests > 0 ? requests : 1;
+    if( _ownsScheduler ) _scheduler->setMaxInFlight( _fetchWindow );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setRecordStore' sets a store where the fields of every fetched record    */
+/* are appended. The store is not owned by GbQuery and may be shared.        */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setRecordStore( GbRecordStore *store )
+{
+    _store = store;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setRecordSink' sets a sink (e.g., a FASTA writer) that receives every    */
+/* record as soon as it is parsed. The sink is not owned by GbQuery.         */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setRecordSink( RecordSink *sink )
+{
+    _sink = sink;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setRecordCache' sets a persistent local cache of records. Records found  */
+/* in the cache are served locally and only the missing ones are fetched.    */
+/* This needs the GIs of every 'esearch' page, so the History server is not  */
+/* used when a cache is set. The cache is not owned by GbQuery.              */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setRecordCache( RecordCache *cache )
+{
+    _cache = cache;
+    if( _cache ) _useHistory = false;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setSharedIds' sets a set of GIs shared by several queries. A GI found in */
+/* the set has already been claimed by another query and is not fetched      */
+/* again (it still counts as fetched for this query). Like the cache, this   */
+/* needs the GIs of every 'esearch' page, so the History server is not used. */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setSharedIds( QSet<ulong> *ids )
+{
+    _sharedIds = ids;
+    if( _sharedIds ) _useHistory = false;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setCheckpoint' sets a checkpoint recording the units of work done. Units */
+/* found in it (from an interrupted run) are not fetched again. The          */
+/* checkpoint is not owned by GbQuery.                                       */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setCheckpoint( Checkpoint *checkpoint )
+{
+    _checkpoint = checkpoint;
+}
+
+// Number of times a failed request is submitted again before giving up
+
+void GbQuery::setRetries( int retries )
+{
+    _maxRetries = retries > 0 ? retries : 0;
+}
+
+// Metrics of every request are added to 'metrics', which is not owned by
+// GbQuery and may be shared by several queries
+
+void GbQuery::setMetrics( Metrics *metrics )
+{
+    _metrics = metrics;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setLimits' bounds the decoded reply bytes waiting to be parsed, the      */
+/* parsed records waiting to be delivered and the GIs found by 'esearch'     */
+/* waiting to be fetched. The limits are soft: a chunk of a reply or a page  */
+/* of GIs may overshoot them, and work stops until they are back to half.    */
+/* Requests in flight are bounded by 'setConcurrency'.                       */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setLimits( qint64 bytes, int records, qsizetype ids )
+{
+    _maxBufferedBytes = qMax( bytes, _readBufferSize );
+    _maxQueuedRecords = qMax( records, 1 );
+    _maxQueuedIds     = qMax( ids, qsizetype( 1 ) );
 }
 
 /*****************************************************************************/
@@ -147,20 +457,34 @@ void GbQuery::setQueryParams(const QString organism,
 void GbQuery::searchNCBI( ulong startAtRecord )
 {
     QNetworkRequest request;
-    QUrl            url;
+    ulong           retMax  {0};
+
+    if( _cancelled ) return;
 
     // Compose the request URL with its individual components. The search term
-    // (species/genus and gene marker) is in variable '_searchTerm'
+    // (species/genus and gene marker) is in variable '_searchTerm', and a
+    // shard adds its date range
 
-    url.setScheme( _scheme );
-    url.setHost( _host );
-    url.setPath( _searchPath );
     QString query = "db=nuccore&term=" + _searchTerm +
-                    "&retmax=" + QString::number( _retMax );
+                    dateRange( _dateType, _minDate, _maxDate );
+
+    if( _useHistory )
+    {
+        // The result set is kept on NCBI's History server, so there is no
+        // need to transfer any GI. 'efetch' will page over it by itself.
 
-    if( startAtRecord > 0 )
+        query += "&usehistory=y&retmax=0";
+    }
+    else
     {
-        query += "&retstart=" +  QString::number( startAtRecord );
+        retMax = searchPageSize();
+
+        query += "&retmax=" + QString::number( retMax );
+
+        if( startAtRecord > 0 )
+        {
+            query += "&retstart=" +  QString::number( startAtRecord );
+        }
     }
 
     // Set the API Key if it exists
@@ -169,32 +493,38 @@ void GbQuery::searchNCBI( ulong startAtRecord )
         query += "&api_key=" + _apiKey;
     }
 
-    url.setQuery( query );
-    request.setUrl( url );
-
-    qDebug() << url.toString();
-
-    request.setRawHeader( "Content-Type",
-                          "text/html,application/xhtml+xml,application/xml" );
+    request = buildRequest( _searchPath, query );
 
     // submit the request to NCBI's eutils!
 
-    QNetworkReply *reply = _manager->get( request );
+    Request *req  = new Request;
+    req->kind     = Search;
+    req->endpoint = "esearch";
+    req->request  = request;
+    req->start    = startAtRecord;
+    req->records  = retMax;
 
-    connect( reply, &QNetworkReply::finished,
-             this,  &GbQuery::processESearch );
+    submit( req );
 }
 
 /*****************************************************************************/
 /*                                                                           */
 /* 'fetchFromNCBI' composes a query to be submited to NCBI's 'efetch' utils  */
+/* for the GIs in '_giList', on behalf of 'unit'                             */
 /*                                                                           */
 /*****************************************************************************/
 
-void GbQuery::fetchFromNCBI()
+void GbQuery::fetchFromNCBI( Unit *unit )
 {
-    QNetworkRequest request;
-    QUrl url;
+    // Long lists of GIs do not fit in a URL. Upload them once with 'epost'
+    // and fetch them in large batches through the returned query key.
+
+    if( _giList.size() > _postThreshold )
+    {
+        postIds( _giList, unit );
+        _giList.clear();
+        return;
+    }
 
     // Transform the list of GIs into a string
 
@@ -209,18 +539,66 @@ void GbQuery::fetchFromNCBI()
 
     QString reqList = QStringLiteral("%1").arg(gis.join(','));
 
+    ulong records = _giList.size();
+
     // Clear the list GIs for eventual new searches
 
     _giList.clear();
 
-    // Compose the request URL with its individual components
+    submitFetch( "db=nuccore&id=" + reqList +
+                 "&retmax=" + QString::number( _retMax ), records, unit );
+}
 
-    url.setScheme( _scheme );
-    url.setHost( _host );
-    url.setPath( _fetchPath );
-    QString query = "db=nuccore&id=" + reqList;
-    query += "&rettype=gb&retmode=xml";
-    query += "&retmax=" + QString::number( _retMax );
+/*****************************************************************************/
+/*                                                                           */
+/* 'fetchFromHistory' fetches 'records' records starting at 'startAtRecord'  */
+/* of a set stored on NCBI's History server (by 'esearch' or 'epost')        */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::fetchFromHistory( const QString &webEnv,
+                                ulong queryKey,
+                                ulong startAtRecord,
+                                ulong records,
+                                Unit *unit )
+{
+    QString query {"db=nuccore"};
+
+    query += "&query_key=" + QString::number( queryKey );
+    query += "&WebEnv=" + webEnv;
+    query += "&retstart=" + QString::number( startAtRecord );
+    query += "&retmax=" + QString::number( records );
+
+    submitFetch( query, records, unit );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'submitFetch' completes a fetch query for the current profile and         */
+/* submits it                                                                */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::submitFetch( QString query, ulong records, Unit *unit )
+{
+    // The metadata only profile is served by 'esummary', which takes the
+    // same 'id' or History server parameters as 'efetch'
+
+    QString path = _fetchPath;
+
+    switch( _profile )
+    {
+        case FetchProfile::Fasta:
+            query += "&rettype=fasta&retmode=text";
+            break;
+        case FetchProfile::Summary:
+            query += "&version=2.0";
+            path = _summaryPath;
+            break;
+        case FetchProfile::GbXml:
+            query += "&rettype=gb&retmode=xml";
+            break;
+    }
 
     // Set the API Key if exists
     if( _apiKey != "" )
@@ -228,165 +606,1504 @@ void GbQuery::fetchFromNCBI()
         query += "&api_key=" + _apiKey;
     }
 
-    url.setQuery( query );
-    request.setUrl( url );
-
-    qDebug() << url.toString();
+    Request *req  = new Request;
+    req->kind     = Fetch;
+    req->endpoint = _profile == FetchProfile::Summary ? "esummary" : "efetch";
+    req->request  = buildRequest( path, query );
+    req->records  = records;
+    req->unit     = unit;
 
-    request.setRawHeader( "Content-Type",
-                          "text/html,application/xhtml+xml,application/xml" );
+    unit->pending++;
 
     // submit the request to NCBI's eutils!
 
-    QNetworkReply *reply = _manager->get( request );
-
-    connect( reply, &QNetworkReply::finished,
-             this,  &GbQuery::processEFetch );
-
+    submit( req );
 }
 
 /*****************************************************************************/
 /*                                                                           */
-/* The SLOT 'processESearch' is triggered by a SIGNAL from QNetworkReply     */
-/* when the search terminates. The connection is established in 'searchNCBI' */
-/* It's function is to process the XML received containing the list of GIs   */
-/* found for the search query (taxon/gene) submitted to 'esearch. If no      */
-/* errors have occurred it should call the function 'fetchFromNCBI' to       */
-/* retrieve the records corresponding to the GI list obtained.               */
+/* 'postIds' uploads a list of GIs to NCBI's History server with an HTTP     */
+/* POST to 'epost'. The IDs travel in the request body, so there is no limit */
+/* on how many of them may be uploaded at once.                              */
 /*                                                                           */
 /*****************************************************************************/
 
-void GbQuery::processESearch()
+void GbQuery::postIds( const QList<ulong> &ids, Unit *unit )
 {
-    int             count     {0};
-    int             retmax    {0};
-    int             retstart  {0};
-
-    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
-
-    // Mark reply for later deletion
-
-    reply->deleteLater();
+    QNetworkRequest request = buildRequest( _postPath, "" );
 
-    // Check if any error has occurred. If not move on otherwise stop
-    // processing this request
+    request.setHeader( QNetworkRequest::ContentTypeHeader,
+                       "application/x-www-form-urlencoded" );
 
-    if( reply->error() == QNetworkReply::NoError )
+    QByteArray body {"db=nuccore&id="};
+    for( qsizetype i = 0; i < ids.size(); ++i )
     {
-        QByteArray bts = reply->readAll();
-
-        Esearch p( bts );
-
-        if( !p.hasError() )
-        {
-
-            count      = p.count();
-            retmax     = p.retMax();
-            retstart   = p.retStart();
-
-            _giList     = p.idList();
+        if( i > 0 ) body.append( ',' );
+        body.append( QByteArray::number( qulonglong( ids.at( i ) ) ) );
+    }
 
-            // Update number of expected records
-            setCount( count );
+    // Set the API Key if it exists
+    if( _apiKey != "" )
+    {
+        body.append( "&api_key=" + _apiKey.toLatin1() );
+    }
 
-            // qDebug() << "Count:    " << count;
-            // qDebug() << "RetMax:   " << retmax;
-            // qDebug() << "RetStart: " << retstart;
-            // qDebug() << "List of IDs";
-            // for( long id : _giList ) qDebug() << id;
+    qDebug() << "Posting" << ids.size() << "IDs";
 
-            fetchFromNCBI();
+    // 'processEPost' needs to know how many IDs were uploaded
 
-            if( retstart + retmax < count )
-            {
-                // If no API Key is provided slow down the number of queries
-                // per second. Otherwise, NCBIs REST API will block you and
-                // the program as well!
+    Request *req  = new Request;
+    req->kind     = Post;
+    req->endpoint = "epost";
+    req->request  = request;
+    req->body     = body;
+    req->records  = ids.size();
+    req->unit     = unit;
 
-                if ( _apiKey == "") QThread::sleep(1);
+    unit->pending++;
 
-                retstart += retmax;
-                emit search( retstart );
-            }
-        }
-        else
-        {
-            qDebug() << p.errorMessage();
-        }
-    }
+    submit( req );
 }
 
 /*****************************************************************************/
 /*                                                                           */
-/* 'processEFetch' is a SLOT linked to the 'finished' SIGNAL of a reply that */
-/* is emitted after a NCBI 'efetch' network query. It reads and parses a XML */
-/* stream with the data from the fetched NCBI records.                       */
+/* 'fetchIds' fetches a given list of GIs (read from a file, for example)    */
+/* instead of the result of a search                                         */
 /*                                                                           */
 /*****************************************************************************/
 
-void GbQuery::processEFetch()
+void GbQuery::fetchIds( const QList<ulong> &ids )
 {
+    _useHistory = false;
+    setCount( ids.size() );
 
-    ulong   records  {0};
-
-    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
-
-    // Mark the reply for deletion later
+    if( ids.isEmpty() )
+    {
+        finish();
+        return;
+    }
 
-    reply->deleteLater();
+    // With a checkpoint the list is fetched in slices of '_postBatch' GIs,
+    // each of them recorded when done. Otherwise it is fetched in one go.
 
-    // Check if any error has occurred. If not move on otherwise stop
-    // processing this request
+    qsizetype    slice = _checkpoint ? qsizetype( _postBatch ) : ids.size();
+    QList<Unit*> local;
 
-    if( reply->error() == QNetworkReply::NoError )
+    for( qsizetype i = 0; i < ids.size(); i += slice )
     {
-        QByteArray bts = reply->readAll();
-
-        Efetch e( bts );
+        _giList = ids.mid( i, slice );
 
-        if( e.hasError() )
-        {
-            qDebug() << e.errorMessage();
-        }
+        Unit *unit    = new Unit;
+        unit->key     = "ids:" + QString::number( i );
+        unit->records = _giList.size();
 
-        records = e.fetchedRecords();
+        fetchGiList( unit );
 
-        // Update records fetched
-        setFetchedRecords( records );
-    }
-    else
-    {
-        qDebug() << reply->error();
+        if( unit->pending == 0 ) local.append( unit );
     }
+
+    // Units served locally may complete the query, so they come last
+
+    for( Unit *unit : local ) finishUnit( unit );
 }
 
 /*****************************************************************************/
 /*                                                                           */
-/* 'setCount' sets the total number of records expected after the first      */
-/* successful query to NCBI. This number is not expected to change during    */
-/* subsequent calls to NCBI for the same query.                              */
+/* 'fetchGiList' fetches the records in '_giList' on behalf of 'unit'.       */
+/* Records already claimed by another query of a batch are left to that      */
+/* query, and records already in the local cache are served from there.      */
+/* Only the rest are fetched from NCBI. A unit recorded as done in the       */
+/* checkpoint is skipped altogether. If nothing is fetched, the unit is left */
+/* for the caller to finish.                                                 */
 /*                                                                           */
 /*****************************************************************************/
 
-void GbQuery::setCount( ulong count )
+void GbQuery::fetchGiList( Unit *unit )
 {
-    if( _count == 0 )
+    if( _checkpoint && _checkpoint->isDone( unit->key ) )
     {
-        _count = count;
+        _giList.clear();
+        return;
     }
+
+    if( _sharedIds ) claimSharedIds();
+    if( cache() ) serveFromCache( unit );
+
+    if( !_giList.isEmpty() ) fetchFromNCBI( unit );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'pumpFetches' keeps at most '_fetchWindow' units of work queued or in     */
+/* flight: pages of the result set stored on NCBI's History server           */
+/* ('pumpHistory'), or batches of the GIs found by 'esearch' otherwise       */
+/* ('pumpIdQueue'). Units are as large as '_fetchSize' allows (or '_retMax'  */
+/* records with a checkpoint). Units recorded as done in the checkpoint are  */
+/* skipped.                                                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::pumpFetches()
+{
+    if( _cancelled || _paused || congested() ) return;
+
+    if( _useHistory )
+    {
+        pumpHistory();
+    }
+    else
+    {
+        pumpIdQueue();
+    }
+}
+
+void GbQuery::pumpHistory()
+{
+    ulong skipped {0};
+
+    while( _nextFetchStart < _count && _fetchesPending < _fetchWindow )
+    {
+        ulong start = _nextFetchStart;
+        ulong size  = _checkpoint ? _retMax : _fetchSize.size();
+
+        Unit *unit    = new Unit;
+        unit->key     = "page:" + QString::number( start );
+        unit->records = qMin( size, _count - start );
+
+        _nextFetchStart += unit->records;
+
+        if( _checkpoint && _checkpoint->isDone( unit->key ) )
+        {
+            skipped += unit->records;
+            delete unit;
+            continue;
+        }
+
+        // With a checkpoint a page may take several requests
+
+        ulong batch = _fetchSize.size();
+
+        unit->pumped = true;
+        _fetchesPending++;
+        for( ulong offset = 0; offset < unit->records; offset += batch )
+        {
+            fetchFromHistory( _webEnv, _queryKey, start + offset,
+                              qMin( batch, unit->records - offset ), unit );
+        }
+    }
+
+    if( skipped > 0 ) setFetchedRecords( skipped );
+}
+
+// With a checkpoint, batches end at multiples of '_retMax' of the result
+// set, so that their keys match those of an interrupted run. Batches with
+// nothing left to fetch from NCBI (claimed by another query, found in the
+// cache, or done) are finished right away.
+
+void GbQuery::pumpIdQueue()
+{
+    QList<Unit*> local;
+
+    while( !_idQueue.isEmpty() && _fetchesPending < _fetchWindow )
+    {
+        IdPage &page  = _idQueue.first();
+        ulong   start = page.start;
+        ulong   size  = _checkpoint ? _retMax - start % _retMax : _fetchSize.size();
+
+        qsizetype n = qMin( qsizetype( size ), page.ids.size() );
+
+        _giList = page.ids.mid( 0, n );
+        page.ids.remove( 0, n );
+        page.start += n;
+        _queuedIds -= n;
+
+        if( page.ids.isEmpty() ) _idQueue.removeFirst();
+
+        Unit *unit    = new Unit;
+        unit->key     = "search:" + QString::number( start );
+        unit->records = n;
+
+        fetchGiList( unit );
+
+        if( unit->pending == 0 )
+        {
+            local.append( unit );
+        }
+        else
+        {
+            unit->pumped = true;
+            _fetchesPending++;
+        }
+    }
+
+    // The queue has room for the next page of GIs again
+
+    if( _searchHeld && _queuedIds <= _maxQueuedIds / 2 )
+    {
+        _searchHeld = false;
+        emit search( _heldSearch );
+    }
+
+    // This may complete the query, so it comes last
+
+    for( Unit *unit : local ) finishUnit( unit );
+}
+
+// The next 'esearch' page is asked for right away, unless the GIs of the
+// pages before it fill the queue. 'pumpIdQueue' asks for it then.
+
+void GbQuery::searchNext( ulong start )
+{
+    if( _queuedIds < _maxQueuedIds )
+    {
+        emit search( start );
+        return;
+    }
+
+    _heldSearch = start;
+    _searchHeld = true;
+}
+
+// Too many decoded bytes wait for the parsers, or too many parsed records
+// wait to be delivered
+
+bool GbQuery::congested()
+{
+    return _bufferedBytes.loadRelaxed() >= _maxBufferedBytes ||
+           _queuedRecords.loadRelaxed() >= _maxQueuedRecords;
+}
+
+// 'esearch' pages bring thousands of GIs at once. With a checkpoint they are
+// a fixed multiple of '_retMax', so that the batches line up across runs.
+
+ulong GbQuery::searchPageSize()
+{
+    if( _checkpoint ) return _retMax * qMax( 1ul, _searchPage / _retMax );
+
+    return _searchSize.size();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'submit' hands a request over to the scheduler. When the request is       */
+/* actually submitted, its reply gets a 'Transfer' and is connected to the   */
+/* SLOTS of its endpoint. A request is submitted again by 'retry' if it      */
+/* fails.                                                                    */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::submit( Request *req )
+{
+    if( req->attempt == 0 ) _requests++;
+
+    // A retry due after 'cancel' is given up
+
+    if( _cancelled )
+    {
+        release( req );
+        return;
+    }
+
+    req->attempt++;
+
+    req->sample        = Metrics::Sample();
+    req->sample.queued = stamp();
+
+    auto started = [this, req]( QNetworkReply *reply ) {
+        _queued.remove( req );
+        req->sample.started = stamp();
+
+        // A request that cannot reuse a connection of the pool opens one.
+        // The connection is up once encrypted (HTTPS) or once the request is
+        // sent (HTTP).
+
+        connect( reply, &QNetworkReply::socketStartedConnecting, this, [this, req]() {
+            req->sample.connecting = stamp();
+        } );
+        connect( reply, &QNetworkReply::encrypted, this, [this, req]() {
+            req->sample.connected = stamp();
+        } );
+        connect( reply, &QNetworkReply::requestSent, this, [this, req]() {
+            if( req->sample.connecting > 0 && req->sample.connected == 0 )
+            {
+                req->sample.connected = stamp();
+            }
+        } );
+
+        Transfer *t = startTransfer( reply, req );
+
+        switch( req->kind )
+        {
+            case Search:
+                connect( reply, &QNetworkReply::readyRead,
+                         this,  &GbQuery::readReply );
+                connect( reply, &QNetworkReply::finished,
+                         this,  &GbQuery::processESearch );
+                break;
+            case Post:
+                connect( reply, &QNetworkReply::readyRead,
+                         this,  &GbQuery::readReply );
+                connect( reply, &QNetworkReply::finished,
+                         this,  &GbQuery::processEPost );
+                break;
+            case Fetch:
+
+                // Each reply gets its own incremental parser, run on the
+                // thread pool and fed from 'readEFetch' as bytes arrive.
+                // Parsed records come back to 'accept' in batches.
+
+                req->seen = 0;
+                req->held.clear();
+
+                t->parse          = new Parse;
+                t->parse->request = req;
+                t->parse->reply   = reply;
+                t->parse->parser  = RecordParser::create( _profile );
+                t->parse->parser->setProjection( parseProjection() );
+                t->parse->parser->setRecordHandler( [p = t->parse]( const GbRecord &r ) {
+                    p->parsed.append( r );
+                } );
+
+                _parses.insert( t->parse );
+
+                // Bytes that are not read yet stay in a small buffer, and
+                // then in the socket (see 'holdReads')
+
+                reply->setReadBufferSize( _readBufferSize );
+
+                connect( reply, &QNetworkReply::readyRead,
+                         this,  &GbQuery::readEFetch );
+                connect( reply, &QNetworkReply::finished,
+                         this,  &GbQuery::processEFetch );
+                break;
+        }
+    };
+
+    _queued.insert( req );
+
+    if( req->kind == Post )
+    {
+        _scheduler->enqueue( this, req->request, req->body, started );
+    }
+    else
+    {
+        _scheduler->enqueue( this, req->request, started );
+    }
+}
+
+// A request is over (for good). Once the query is finishing, the last one
+// lets 'quit' go out.
+
+void GbQuery::release( Request *req )
+{
+    delete req;
+    _requests--;
+
+    if( _finishing || _cancelled )
+    {
+        QMetaObject::invokeMethod( this, &GbQuery::windDown, Qt::QueuedConnection );
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'stamp' and 'report' collect the metrics of every attempt of a request:   */
+/* when it was queued, submitted, got its first byte and finished, how long  */
+/* its reply took to parse and how many bytes and records it brought. They   */
+/* are reported only if metrics were asked for.                              */
+/*                                                                           */
+/*****************************************************************************/
+
+qint64 GbQuery::stamp()
+{
+    return _clock.nsecsElapsed();
+}
+
+void GbQuery::report( Request *req, Metrics::Outcome outcome )
+{
+    _requestsSent++;
+    if( req->sample.connecting > 0 ) _connections++;
+
+    if( _metrics ) _metrics->add( req->endpoint, req->sample, outcome );
+}
+
+// 'adapt' tells the batch sizer of the endpoint how a request went. Replies
+// throttled by the rate limit say nothing about the size of the batch.
+
+void GbQuery::adapt( Request *req, QNetworkReply *reply, bool ok )
+{
+    BatchSizer *sizer = req->kind == Search ? &_searchSize :
+                        req->kind == Fetch  ? &_fetchSize  : nullptr;
+
+    if( !sizer ) return;
+
+    if( ok )
+    {
+        const Metrics::Sample &s = req->sample;
+        sizer->observe( s.records, ( s.finished - s.started ) / 1e9, s.bytesDecoded );
+    }
+    else if( reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() != 429 )
+    {
+        sizer->observeFailure();
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'retry' submits a failed request again after a delay that doubles with    */
+/* every attempt (plus some jitter, so that concurrent requests do not come  */
+/* back all at once). NCBI answers with HTTP 429 when the rate limit is      */
+/* exceeded and with 5xx errors when overloaded, and sometimes sends a       */
+/* truncated or malformed document with a success status; all of them are    */
+/* transient. Other errors (a wrong URL, for example) are not retried. It    */
+/* returns false if the request is given up.                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+bool GbQuery::retry( Request *req, QNetworkReply *reply )
+{
+    // Replies aborted by 'cancel' fail with 'OperationCanceledError', like
+    // those of a stalled transfer, but are not worth another attempt
+
+    if( _cancelled ) return false;
+
+    const int status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+
+    bool transient {false};
+
+    switch( reply->error() )
+    {
+        case QNetworkReply::NoError:
+        case QNetworkReply::ConnectionRefusedError:
+        case QNetworkReply::RemoteHostClosedError:
+        case QNetworkReply::HostNotFoundError:
+        case QNetworkReply::TimeoutError:
+        case QNetworkReply::OperationCanceledError:
+        case QNetworkReply::TemporaryNetworkFailureError:
+        case QNetworkReply::NetworkSessionFailedError:
+        case QNetworkReply::UnknownNetworkError:
+        case QNetworkReply::ProxyTimeoutError:
+        case QNetworkReply::InternalServerError:
+        case QNetworkReply::ServiceUnavailableError:
+        case QNetworkReply::UnknownServerError:
+            transient = true;
+            break;
+        default:
+            transient = status == 429 || status >= 500;
+            break;
+    }
+
+    if( !transient || req->attempt > _maxRetries )
+    {
+        return false;
+    }
+
+    // The shift is bounded, so that a large number of retries cannot
+    // overflow it (a second shifted 20 times is already days)
+
+    const int shift = qBound( 0, req->attempt - 1, 20 );
+
+    qint64 delay = qMin<qint64>( qint64( _retryDelay ) << shift, _maxRetryDelay );
+    delay = delay / 2 + QRandomGenerator::global()->bounded( delay / 2 + 1 );
+
+    // Honour the delay asked for by the server, if any, but never wait longer
+    // than '_maxRetryDelay'
+
+    bool   ok         {false};
+    qint64 retryAfter = reply->rawHeader( "Retry-After" ).toLongLong( &ok );
+    if( ok && retryAfter > 0 )
+    {
+        delay = qMax( delay, qMin<qint64>( retryAfter, _maxRetryDelay / 1000 + 1 ) * 1000 );
+    }
+    delay = qMin<qint64>( delay, _maxRetryDelay );
+
+    qDebug() << req->endpoint << "failed (HTTP" << status << ")"
+             << "retrying in" << delay << "ms, attempt" << req->attempt + 1;
+
+    QTimer::singleShot( int( delay ), this, [this, req]() {
+        submit( req );
+    } );
+
+    return true;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'accept' is the record handler of every fetch. Without a checkpoint the   */
+/* records are delivered as soon as they are parsed; records delivered by a  */
+/* previous (failed) attempt of the same request are not delivered again.    */
+/* With a checkpoint they are held until the whole unit is done, so that the */
+/* output only ever holds complete units (see 'finishUnit').                 */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::accept( Request *req, const GbRecord &r )
+{
+    if( _checkpoint )
+    {
+        req->held.append( r );
+        return;
+    }
+
+    if( req->seen++ < req->delivered ) return;
+
+    req->delivered++;
+
+    if( cache() && _profile == FetchProfile::GbXml ) _cache->insert( r );
+    deliver( r );
+}
+
+void GbQuery::hold( Unit *unit, const GbRecord &r )
+{
+    if( _checkpoint )
+    {
+        unit->held.append( r );
+    }
+    else
+    {
+        deliver( r );
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'finishUnit' is called when every request of a unit is over. The records  */
+/* held for it are delivered, the output is flushed and the unit is recorded */
+/* as done in the checkpoint together with the size of the output. A unit    */
+/* whose requests were given up is not recorded, so that a resumed run       */
+/* fetches it again. Either way its records are accounted for.               */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::finishUnit( Unit *unit )
+{
+    if( unit->failed )
+    {
+        qDebug() << "Giving up on" << unit->key << ":"
+                 << unit->records << "records not fetched";
+        _recordsFailed += unit->records;
+    }
+    else if( _checkpoint && !_checkpoint->isDone( unit->key ) )
+    {
+        for( const GbRecord &r : unit->held ) deliver( r );
+
+        qint64 size {-1};
+        if( _sink )
+        {
+            _sink->flush();
+            size = _sink->size();
+        }
+        _checkpoint->markDone( unit->key, size );
+    }
+
+    ulong records = unit->records;
+    bool  pumped  = unit->pumped;
+    delete unit;
+
+    // A finished page or batch (successful or not) makes room for the next
+
+    if( pumped )
+    {
+        _fetchesPending--;
+        pumpFetches();
+    }
+
+    setFetchedRecords( records );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'searchFailed' gives up on an 'esearch' request. Without the first page   */
+/* (or in History mode, where there is a single search) nothing can be       */
+/* fetched. Otherwise the records of the page are accounted for as failed    */
+/* and the search goes on with the next page.                                */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::searchFailed( Request *req )
+{
+    if( _useHistory || _count == 0 )
+    {
+        qDebug() << "Giving up search";
+        _searchFailed = true;
+        finish();
+        return;
+    }
+
+    ulong records = req->start < _count ? qMin( req->records, _count - req->start ) : 0;
+
+    qDebug() << "Giving up search page at" << req->start << ":"
+             << records << "records not fetched";
+
+    _recordsFailed += records;
+
+    if( req->start + req->records < _count )
+    {
+        searchNext( req->start + req->records );
+    }
+
+    setFetchedRecords( records );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'buildRequest' composes the request for an eutils endpoint. Every request */
+/* explicitly asks for a compressed reply (see 'inflater.cpp') and allows    */
+/* HTTP/2, so that concurrent requests share a single connection. A reply    */
+/* stalled for longer than '_transferTimeout' is aborted (and retried).      */
+/*                                                                           */
+/*****************************************************************************/
+
+QNetworkRequest GbQuery::buildRequest( const QString &path, const QString &query )
+{
+    QNetworkRequest request;
+    QUrl            url;
+
+    url.setScheme( _scheme );
+    url.setHost( _host );
+    url.setPort( _port );
+    url.setPath( path );
+    if( query != "" ) url.setQuery( query );
+    request.setUrl( url );
+
+    qDebug() << url.toString();
+
+    request.setRawHeader( "Accept", "application/xml, text/xml, text/plain" );
+    request.setRawHeader( "Accept-Encoding", "gzip, deflate" );
+    request.setAttribute( QNetworkRequest::Http2AllowedAttribute, true );
+    request.setTransferTimeout( _transferTimeout );
+
+    return request;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* Every reply has a 'Transfer' that decodes its body and counts its bytes.  */
+/* 'startTransfer' creates it when the request is submitted, 'decode' reads  */
+/* and decodes the bytes available, and 'finishTransfer' decodes the rest of */
+/* the reply, reports the bytes on the wire versus the decoded bytes and     */
+/* disposes of the 'Transfer'.                                               */
+/*                                                                           */
+/*****************************************************************************/
+
+GbQuery::Transfer *GbQuery::startTransfer( QNetworkReply *reply,
+                                           Request *req )
+{
+    Transfer *t = new Transfer;
+    t->request = req;
+    _transfers.insert( reply, t );
+    return t;
+}
+
+QByteArray GbQuery::decode( QNetworkReply *reply, Transfer *t )
+{
+    if( !t->inflater.started() )
+    {
+        t->request->sample.firstByte = stamp();
+        t->inflater.begin( reply->rawHeader( "Content-Encoding" ) );
+    }
+
+    QByteArray bytes = t->inflater.inflate( reply->readAll() );
+
+    if( t->inflater.hasError() )
+    {
+        qDebug() << t->inflater.errorMessage();
+    }
+    return bytes;
+}
+
+QByteArray GbQuery::finishTransfer( QNetworkReply *reply )
+{
+    Transfer *t = _transfers.take( reply );
+
+    if( !t ) return QByteArray();
+
+    t->body += decode( reply, t );
+
+    _bytesOnWire  += t->inflater.bytesIn();
+    _bytesDecoded += t->inflater.bytesOut();
+
+    Metrics::Sample &sample = t->request->sample;
+    sample.finished     = stamp();
+    sample.bytesOnWire  = t->inflater.bytesIn();
+    sample.bytesDecoded = t->inflater.bytesOut();
+
+    qDebug() << t->request->endpoint << ":"
+             << t->inflater.bytesIn()  << "bytes on the wire,"
+             << t->inflater.bytesOut() << "bytes decoded";
+
+    QByteArray body = t->body;
+    delete t;
+    return body;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'readReply' is a SLOT linked to the 'readyRead' SIGNAL of 'esearch' and   */
+/* 'epost' replies. Their (small) bodies are decoded as bytes arrive and     */
+/* kept until the reply is finished.                                         */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::readReply()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
+
+    Transfer *t = _transfers.value( reply, nullptr );
+
+    if( t ) t->body += decode( reply, t );
+}
+
+qint64 GbQuery::bytesOnWire()
+{
+    return _bytesOnWire;
+}
+
+qint64 GbQuery::bytesDecoded()
+{
+    return _bytesDecoded;
+}
+
+// Requests sent (every attempt counts), and how many of them had to open a
+// connection instead of reusing one
+
+ulong GbQuery::requestsSent()
+{
+    return _requestsSent;
+}
+
+ulong GbQuery::connectionsOpened()
+{
+    return _connections;
+}
+
+// Records parsed so far, by every worker. Records of a failed reply that is
+// retried are counted again.
+
+ulong GbQuery::recordsParsed()
+{
+    return _recordsParsed.loadRelaxed();
+}
+
+// A query has failed if any of its requests was given up
+
+bool GbQuery::hasFailed()
+{
+    return _searchFailed || _recordsFailed > 0;
+}
+
+ulong GbQuery::failedRecords()
+{
+    return _recordsFailed;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'deliver' hands a record over to the record store (if any), the sink (if  */
+/* any) and emits it right away through the 'record' SIGNAL.                 */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::deliver( const GbRecord &r )
+{
+    if( _cancelled ) return;
+
+    if( _store ) _store->append( r );
+    if( _sink ) _sink->write( r );
+    emit record( r );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'serveFromCache' delivers the records of '_giList' found in the local     */
+/* cache (on behalf of 'unit') and leaves in '_giList' only those that must  */
+/* be fetched from NCBI.                                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::serveFromCache( Unit *unit )
+{
+    GbRecord        r;
+    QList<ulong>    missing;
+
+    for( const ulong gi : _giList )
+    {
+        if( _cache->find( gi, r ) )
+        {
+            hold( unit, r );
+        }
+        else
+        {
+            missing.append( gi );
+        }
+    }
+
+    _giList = missing;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'claimSharedIds' removes from '_giList' the GIs already claimed by other  */
+/* queries and claims the rest. It returns the number of GIs removed.        */
+/*                                                                           */
+/*****************************************************************************/
+
+ulong GbQuery::claimSharedIds()
+{
+    QList<ulong>    unclaimed;
+    ulong           claimed {0};
+
+    for( const ulong gi : _giList )
+    {
+        if( _sharedIds->contains( gi ) )
+        {
+            claimed++;
+        }
+        else
+        {
+            _sharedIds->insert( gi );
+            unclaimed.append( gi );
+        }
+    }
+
+    _giList = unclaimed;
+    return claimed;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* The SLOT 'processESearch' is triggered by a SIGNAL from QNetworkReply     */
+/* when the search terminates. The connection is established in 'searchNCBI' */
+/* It's function is to process the XML received containing the list of GIs   */
+/* found for the search query (taxon/gene) submitted to 'esearch. If no      */
+/* errors have occurred it should call the function 'fetchFromNCBI' to       */
+/* retrieve the records corresponding to the GI list obtained.               */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::processESearch()
+{
+    int             count     {0};
+    int             retmax    {0};
+    int             retstart  {0};
+
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
+
+    // Mark reply for later deletion
+
+    reply->deleteLater();
+
+    Request *req = _transfers.value( reply )->request;
+
+    // Collect whatever was left to read and account for the transfer
+
+    QByteArray bts = finishTransfer( reply );
+
+    // Check if any error has occurred. If not move on otherwise retry the
+    // request (or give up on it)
+
+    if( reply->error() == QNetworkReply::NoError )
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        Esearch p( bts );
+
+        req->sample.parse   = timer.nsecsElapsed();
+        req->sample.records = p.idList().size();
+
+        if( !p.hasError() )
+        {
+            report( req, Metrics::Succeeded );
+            adapt( req, reply, true );
+            release( req );
+
+            count      = p.count();
+            retmax     = p.retMax();
+            retstart   = p.retStart();
+
+            // Update number of expected records
+            setCount( count );
+
+            // Make room for all records at once in the record store
+
+            if( _store && retstart == 0 )
+            {
+                _store->reserve( _store->size() + count, 0 );
+            }
+
+            // Nothing to fetch, we are done
+
+            if( count == 0 )
+            {
+                finish();
+                return;
+            }
+
+            if( _useHistory )
+            {
+                // A single search is enough. Keep the keys to the result set
+                // stored on the History server and start paging with 'efetch'
+
+                _webEnv   = p.webEnv();
+                _queryKey = p.queryKey();
+
+                pumpFetches();
+                return;
+            }
+
+            // qDebug() << "Count:    " << count;
+            // qDebug() << "RetMax:   " << retmax;
+            // qDebug() << "RetStart: " << retstart;
+
+            // The page of GIs joins the queue. Pages arrive in order, since
+            // the next one is only requested once this one is over.
+
+            IdPage page;
+            page.start = retstart;
+            page.ids   = p.idList();
+            if( !page.ids.isEmpty() ) _idQueue.append( page );
+            _queuedIds += page.ids.size();
+
+            if( retstart + retmax < count )
+            {
+                // There is no need to slow down here. The scheduler makes
+                // sure we do not exceed the number of queries per second
+                // allowed by NCBI.
+
+                retstart += retmax;
+                searchNext( retstart );
+            }
+
+            // This may complete the query, so it comes last
+
+            pumpFetches();
+            return;
+        }
+        else
+        {
+            qDebug() << p.errorMessage();
+        }
+    }
+    else
+    {
+        qDebug() << reply->error();
+    }
+
+    adapt( req, reply, false );
+
+    if( retry( req, reply ) )
+    {
+        report( req, Metrics::Retried );
+        return;
+    }
+
+    report( req, Metrics::Failed );
+    searchFailed( req );
+    release( req );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'processEPost' is a SLOT linked to the 'finished' SIGNAL of an 'epost'    */
+/* reply. It fetches the uploaded IDs in batches (of the current size of     */
+/* '_fetchSize') through the query key returned.                             */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::processEPost()
+{
+    bool ok {false};
+
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
+
+    // Mark reply for later deletion
+
+    reply->deleteLater();
+
+    Request *req = _transfers.value( reply )->request;
+
+    QByteArray bts = finishTransfer( reply );
+
+    if( reply->error() == QNetworkReply::NoError )
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        Epost p( bts );
+
+        req->sample.parse = timer.nsecsElapsed();
+
+        if( !p.hasError() )
+        {
+            ulong posted = req->records;
+
+            ulong batch  = _fetchSize.size();
+
+            for( ulong start = 0; start < posted; start += batch )
+            {
+                fetchFromHistory( p.webEnv(), p.queryKey(), start,
+                                  qMin( batch, posted - start ), req->unit );
+            }
+            ok = true;
+        }
+        else
+        {
+            qDebug() << p.errorMessage();
+        }
+    }
+    else
+    {
+        qDebug() << reply->error();
+    }
+
+    if( !ok && retry( req, reply ) )
+    {
+        report( req, Metrics::Retried );
+        return;
+    }
+
+    report( req, ok ? Metrics::Succeeded : Metrics::Failed );
+
+    // The batches (if any) now stand for the upload in the unit
+
+    Unit *unit = req->unit;
+    if( !ok ) unit->failed = true;
+    release( req );
+
+    if( --unit->pending == 0 ) finishUnit( unit );
 }
 
-void GbQuery::setFetchedRecords( ulong records )
+/*****************************************************************************/
+/*                                                                           */
+/* 'readEFetch' is a SLOT linked to the 'readyRead' SIGNAL of an 'efetch'    */
+/* reply. It feeds the bytes received so far to the reply's parser, so that  */
+/* parsing overlaps the download.                                            */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::readEFetch()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
+
+    Transfer *t = _transfers.value( reply, nullptr );
+
+    if( t ) readFetch( reply, t );
+}
+
+void GbQuery::readFetch( QNetworkReply *reply, Transfer *t )
+{
+    if( reply->error() != QNetworkReply::NoError || holdReads() ) return;
+
+    feed( t->parse, decode( reply, t ), false );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'holdReads' tells whether replies must be left unread, because too many   */
+/* decoded bytes wait for the parsers. It then sets '_readsHeld', and the    */
+/* worker that brings them back to half the limit calls 'resumeReads'. The   */
+/* bytes are checked again once the flag is set, in case the workers caught  */
+/* up in the meantime.                                                       */
+/*                                                                           */
+/*****************************************************************************/
+
+bool GbQuery::holdReads()
+{
+    if( _bufferedBytes.loadAcquire() < _maxBufferedBytes ) return false;
+
+    _readsHeld.storeRelease( 1 );
+
+    return _bufferedBytes.loadAcquire() >= _maxBufferedBytes ||
+           !_readsHeld.testAndSetOrdered( 1, 0 );
+}
+
+// Whatever the 'efetch' replies received while reads were held, and the
+// fetches that were not started
+
+void GbQuery::resumeReads()
+{
+    const QList<QNetworkReply *> replies = _transfers.keys();
+
+    for( QNetworkReply *reply : replies )
+    {
+        Transfer *t = _transfers.value( reply );
+        if( t->parse && reply->bytesAvailable() > 0 ) readFetch( reply, t );
+    }
+
+    pumpFetches();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'processEFetch' is a SLOT linked to the 'finished' SIGNAL of a reply that */
+/* is emitted after a NCBI 'efetch' network query. It feeds the last bytes   */
+/* of the XML stream to the reply's parser; the reply is dealt with by       */
+/* 'fetchParsed' once the parse is over.                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::processEFetch()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>( sender() );
+
+    Transfer *t = _transfers.value( reply );
+    Parse *p = t->parse;
+    t->parse = nullptr;
+
+    // Decode whatever was left to read and account for the transfer
+
+    QByteArray bts = finishTransfer( reply );
+
+    // The bytes of a failed reply are not worth parsing, but the parser may
+    // still be busy with earlier ones
+
+    feed( p, reply->error() == QNetworkReply::NoError ? bts : QByteArray(), true );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'feed' hands bytes of an 'efetch' reply over to its parse, and starts a   */
+/* worker on the thread pool unless one is running already. 'drain' is run   */
+/* by the worker: it parses whatever input there is until none is left, and  */
+/* sends the records parsed back to the thread of GbQuery (the records of a  */
+/* reply are thus accepted in order). Parsing whole GBSets no longer stalls  */
+/* the event loop, and the replies in flight are parsed on several cores     */
+/* while others are still being downloaded.                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::feed( Parse *p, const QByteArray &bytes, bool last )
+{
+    if( bytes.isEmpty() && !last ) return;
+
+    _bufferedBytes.fetchAndAddRelaxed( bytes.size() );
+
+    {
+        QMutexLocker lock( &p->mutex );
+
+        p->input += bytes;
+        p->last   = last;
+
+        if( p->running ) return;
+        p->running = true;
+    }
+
+    QThreadPool::globalInstance()->start( [this, p]() { drain( p ); } );
+}
+
+void GbQuery::drain( Parse *p )
+{
+    while( true )
+    {
+        QByteArray input;
+        bool       last;
+
+        // Too many parsed records wait to be delivered. The parse stops, its
+        // input left buffered, until 'accept' relieves it. The records are
+        // checked again once it is stopped, in case they were delivered in
+        // the meantime.
+
+        if( _queuedRecords.loadAcquire() >= _maxQueuedRecords )
+        {
+            {
+                QMutexLocker lock( &p->mutex );
+                p->running = false;
+            }
+
+            if( _queuedRecords.loadAcquire() >= _maxQueuedRecords ) return;
+
+            QMutexLocker lock( &p->mutex );
+            if( p->running ) return;
+            p->running = true;
+        }
+
+        {
+            QMutexLocker lock( &p->mutex );
+
+            if( p->input.isEmpty() && !p->last )
+            {
+                p->running = false;
+                return;
+            }
+
+            input.swap( p->input );
+            last = p->last;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        p->parser->addData( input );
+        if( last ) p->parser->finish();
+
+        p->time += timer.nsecsElapsed();
+
+        // Replies left unread can be read again
+
+        qint64 buffered = _bufferedBytes.fetchAndAddOrdered( -input.size() ) - input.size();
+
+        if( buffered <= _maxBufferedBytes / 2 && _readsHeld.testAndSetOrdered( 1, 0 ) )
+        {
+            QMetaObject::invokeMethod( this, [this]() {
+                resumeReads();
+            }, Qt::QueuedConnection );
+        }
+
+        QList<GbRecord> records;
+        records.swap( p->parsed );
+
+        _recordsParsed.fetchAndAddRelaxed( records.size() );
+
+        if( !records.isEmpty() )
+        {
+            _queuedRecords.fetchAndAddOrdered( int( records.size() ) );
+
+            QMetaObject::invokeMethod( this, [this, p, records]() {
+                accept( p, records );
+            }, Qt::QueuedConnection );
+        }
+
+        // The parse is over; the worker stays 'running' for good
+
+        if( last )
+        {
+            QMetaObject::invokeMethod( this, [this, p]() {
+                fetchParsed( p );
+            }, Qt::QueuedConnection );
+            return;
+        }
+    }
+}
+
+void GbQuery::accept( Parse *p, const QList<GbRecord> &records )
+{
+    for( const GbRecord &r : records ) accept( p->request, r );
+
+    // Parses stopped by the records waiting can go on
+
+    int n      = int( records.size() );
+    int queued = _queuedRecords.fetchAndAddOrdered( -n ) - n;
+
+    if( queued <= _maxQueuedRecords / 2 ) relieve();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'relieve' starts a worker again for every parse that stopped with input   */
+/* left (see 'drain'), and the fetches that were not started meanwhile       */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::relieve()
+{
+    for( Parse *p : std::as_const( _parses ) )
+    {
+        {
+            QMutexLocker lock( &p->mutex );
+
+            if( p->running || ( p->input.isEmpty() && !p->last ) ) continue;
+            p->running = true;
+        }
+
+        QThreadPool::globalInstance()->start( [this, p]() { drain( p ); } );
+    }
+
+    pumpFetches();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'fetchParsed' is called once the parse of an 'efetch' reply is over. A    */
+/* failed fetch is retried; once it succeeds (or is given up) it counts as   */
+/* done for its unit.                                                        */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::fetchParsed( Parse *p )
+{
+    bool ok {false};
+
+    QNetworkReply *reply = p->reply;
+    Request *req = p->request;
+
+    // Mark the reply for deletion later
+
+    reply->deleteLater();
+
+    // Check if any error has occurred. If not move on otherwise retry the
+    // request (or give up on it)
+
+    if( reply->error() == QNetworkReply::NoError )
+    {
+        if( p->parser->hasError() )
+        {
+            qDebug() << p->parser->errorMessage();
+        }
+        else
+        {
+            ok = true;
+        }
+    }
+    else
+    {
+        qDebug() << reply->error();
+    }
+
+    req->sample.parse   = p->time;
+    req->sample.records = p->parser->fetchedRecords();
+
+    _parses.remove( p );
+    delete p->parser;
+    delete p;
+
+    adapt( req, reply, ok );
+
+    if( !ok && retry( req, reply ) )
+    {
+        report( req, Metrics::Retried );
+        return;
+    }
+
+    report( req, ok ? Metrics::Succeeded : Metrics::Failed );
+
+    Unit *unit = req->unit;
+
+    if( ok )
+    {
+        // Records held for a checkpoint join those of their unit
+
+        for( const GbRecord &r : req->held )
+        {
+            if( cache() && _profile == FetchProfile::GbXml ) _cache->insert( r );
+        }
+        unit->held += req->held;
+
+        // Write the new records to the cache's data file
+
+        if( cache() ) _cache->commit();
+    }
+    else
+    {
+        unit->failed = true;
+    }
+
+    release( req );
+
+    if( --unit->pending == 0 ) finishUnit( unit );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setCount' sets the total number of records expected after the first      */
+/* successful query to NCBI. This number is not expected to change during    */
+/* subsequent calls to NCBI for the same query.                              */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setCount( ulong count )
 {
-    QMutex mutex;
-    mutex.lock();
-    _recordsFetched += records;
-    mutex.unlock();
-    if( _recordsFetched == _count )
+    if( _count == 0 )
     {
-        emit quit();
+        _count = count;
     }
 }
 
+// Records are accounted for once their unit is over. The query is complete
+// when all of them are.
+
+void GbQuery::setFetchedRecords( ulong records )
+{
+    ulong fetched = _recordsFetched.fetchAndAddOrdered( records ) + records;
+
+    if( _count > 0 && fetched >= _count ) finish();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'finish' marks the query as over. 'quit' is emitted exactly once, by      */
+/* 'windDown', from the event loop and only when no request, reply or parse  */
+/* is left: nothing can then call back into the query (not a reply, a worker */
+/* of the thread pool or the scheduler), and it may be deleted.              */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::finish()
+{
+    _finishing = true;
+    QMetaObject::invokeMethod( this, &GbQuery::windDown, Qt::QueuedConnection );
+}
+
+void GbQuery::windDown()
+{
+    if( !_finishing && !_cancelled ) return;
+
+    if( _requests > 0 || !_transfers.isEmpty() || !_parses.isEmpty() ) return;
+
+    if( !_finished.testAndSetOrdered( 0, 1 ) ) return;
+
+    qDebug() << "Requests sent:" << _requestsSent
+             << "connections opened:" << _connections;
+
+    emit quit();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'setPaused' stops submitting new fetches (for a consumer that cannot keep */
+/* up, see 'recordstream.cpp') or starts again. Requests already queued or   */
+/* in flight go on.                                                          */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::setPaused( bool paused )
+{
+    if( _paused == paused ) return;
+
+    _paused = paused;
+    if( !_paused ) pumpFetches();
+}
+
+bool GbQuery::isPaused()
+{
+    return _paused;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'cancel' gives up on the query: the replies in flight are aborted, those  */
+/* still queued in the scheduler are aborted as soon as they start, and no   */
+/* request is retried or submitted any more. No record is delivered after    */
+/* 'cancel'. 'quit' is emitted once the fetches in flight have wound down,   */
+/* so that the query can then be deleted.                                    */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbQuery::cancel()
+{
+    if( _cancelled ) return;
+
+    qDebug() << "Cancelling query";
+    _cancelled = true;
+
+    // Requests still waiting in the scheduler are dropped
+
+    _scheduler->cancel( this );
+
+    const QList<Request *> queued = _queued.values();
+    _queued.clear();
+    for( Request *req : queued ) release( req );
+
+    const QList<QNetworkReply *> replies = _transfers.keys();
+    for( QNetworkReply *reply : replies ) reply->abort();
+
+    QMetaObject::invokeMethod( this, &GbQuery::windDown, Qt::QueuedConnection );
+}
+
+bool GbQuery::isCancelled()
+{
+    return _cancelled;
+}
+
 
 
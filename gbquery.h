@@ -1,11 +1,29 @@
 #ifndef GBQUERY_H
 #define GBQUERY_H
 
-
-#include <QNetworkAccessManager>
 #include <QString>
 #include <QList>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QDate>
 #include <QObject>
+#include <QNetworkRequest>
+
+#include "gbrecord.h"
+#include "inflater.h"
+#include "batchsizer.h"
+#include "metrics.h"
+#include "recordparser.h"
+#include "scheduler.h"
+
+class GbRecordStore;
+class RecordSink;
+class RecordCache;
+class Checkpoint;
+class QNetworkReply;
 
 class GbQuery : public QObject
 {
@@ -13,14 +31,46 @@ class GbQuery : public QObject
 
 public:
     explicit        GbQuery( QObject * parent = nullptr );
+    explicit        GbQuery( Scheduler *, QObject * parent = nullptr );
     ~GbQuery();
     void            setQueryParams( const QString,
                                     const QString,
                                     const QString,
                                     const ulong );
+    void            setEndpoint( const QString &, const QString &, int port = -1 );
+    void            setDateRange( const QString &, const QDate &, const QDate & );
+    void            setUseHistory( bool );
+    void            setAdaptive( bool );
+    void            setProfile( FetchProfile );
+    void            setProjection( const Projection & );
+    void            setConcurrency( int );
+    void            setRecordStore( GbRecordStore * );
+    void            setRecordSink( RecordSink * );
+    void            setRecordCache( RecordCache * );
+    void            setSharedIds( QSet<ulong> * );
+    void            setCheckpoint( Checkpoint * );
+    void            setRetries( int );
+    void            setMetrics( Metrics * );
+    void            setLimits( qint64, int, qsizetype );
+    void            fetchIds( const QList<ulong> & );
+    void            setPaused( bool );
+    bool            isPaused();
+    void            cancel();
+    bool            isCancelled();
+    qint64          bytesOnWire();
+    qint64          bytesDecoded();
+    ulong           requestsSent();
+    ulong           connectionsOpened();
+    ulong           recordsParsed();
+    bool            hasFailed();
+    ulong           failedRecords();
+
+    static QString  searchTerm( const QString &, const QString & );
+    static QString  dateRange( const QString &, const QDate &, const QDate & );
 
 signals:
     void            search( ulong );
+    void            record( const GbRecord & );
     void            quit();
 
 public slots:
@@ -32,24 +82,222 @@ private:
     QString         _marker         {""};
     QString         _scheme         {"https"};
     QString         _host           {"eutils.ncbi.nlm.nih.gov"};
+    int             _port           {-1};
     QString         _searchPath     {"/entrez/eutils/esearch.fcgi"};
     QString         _fetchPath      {"/entrez/eutils/efetch.fcgi"};
+    QString         _postPath       {"/entrez/eutils/epost.fcgi"};
+    QString         _summaryPath    {"/entrez/eutils/esummary.fcgi"};
     QString         _searchTerm     {""};
+    QString         _dateType       {"pdat"};
+    QDate           _minDate;
+    QDate           _maxDate;
     ulong           _retMax         {20};
+    BatchSizer      _searchSize;
+    BatchSizer      _fetchSize;
+    bool            _useHistory     {true};
+    FetchProfile    _profile        {FetchProfile::GbXml};
+    Projection      _projection;
+    QString         _webEnv         {""};
+    ulong           _queryKey       {0};
+    ulong           _nextFetchStart {0};
+    int             _fetchesPending {0};
+    int             _fetchWindow    {4};
+    qsizetype       _postThreshold  {200};
+    ulong           _postBatch      {500};
+    ulong           _searchPage     {5000};
 
-    ulong           _recordsFetched {0};
+    int             _maxRetries     {5};
+    int             _retryDelay     {1000};
+    int             _maxRetryDelay  {60000};
+    int             _transferTimeout{120000};
+
+    // Bounds of the work in flight (see 'setLimits')
+
+    qint64          _maxBufferedBytes   {64 << 20};
+    int             _maxQueuedRecords   {5000};
+    qsizetype       _maxQueuedIds       {50000};
+    qint64          _readBufferSize     {1 << 20};
+    qsizetype       _queuedIds          {0};
+    ulong           _heldSearch         {0};
+    bool            _searchHeld         {false};
+
+    ulong           _recordsFailed  {0};
+    bool            _searchFailed   {false};
+    bool            _paused         {false};
+    bool            _cancelled      {false};
     ulong           _count          {0};
 
+    // Progress, safe to read and update from any thread
+
+    QAtomicInteger<ulong>           _recordsFetched {0};
+    QAtomicInteger<ulong>           _recordsParsed  {0};
+    QAtomicInt                      _finished       {0};
+
+    // Decoded reply bytes not parsed yet, and parsed records not delivered
+    // yet. '_readsHeld' is set while replies are left unread.
+
+    QAtomicInteger<qint64>          _bufferedBytes  {0};
+    QAtomicInt                      _queuedRecords  {0};
+    QAtomicInt                      _readsHeld      {0};
+
     QList<ulong>    _giList;
 
-    QNetworkAccessManager           *_manager;
+    // A unit of work: a page of the result set, or a slice of a list of GIs.
+    // Its records are accounted for once every request of the unit is over,
+    // and it is then recorded in the checkpoint (if any).
+
+    struct Unit
+    {
+        QString         key;
+        ulong           records         {0};
+        int             pending         {0};
+        bool            failed          {false};
+        bool            pumped          {false};
+        QList<GbRecord> held;
+    };
+
+    // GIs returned by 'esearch' and not fetched yet, by page of the result
+    // set ('start' is the position of the first GI in it)
+
+    struct IdPage
+    {
+        ulong           start           {0};
+        QList<ulong>    ids;
+    };
+
+    QList<IdPage>   _idQueue;
+
+    // A request to an eutils endpoint, kept until it succeeds or runs out of
+    // attempts
+
+    enum Kind
+    {
+        Search,
+        Post,
+        Fetch
+    };
+
+    struct Request
+    {
+        Kind            kind            {Search};
+        const char      *endpoint       {""};
+        QNetworkRequest request;
+        QByteArray      body;
+        ulong           start           {0};
+        ulong           records         {0};
+        int             attempt         {0};
+        ulong           seen            {0};
+        ulong           delivered       {0};
+        QList<GbRecord> held;
+        Unit            *unit           {nullptr};
+        Metrics::Sample sample;
+    };
+
+    // The parsing of an 'efetch' reply on the thread pool. Bytes are
+    // appended to 'input' as they arrive and parsed in order, by one worker
+    // at a time; 'mutex' guards 'input', 'last' and 'running'. The rest is
+    // only touched by the worker running, until the parse is over.
+
+    struct Parse
+    {
+        Request         *request        {nullptr};
+        QNetworkReply   *reply          {nullptr};
+        RecordParser    *parser         {nullptr};
+        QList<GbRecord> parsed;
+        qint64          time            {0};
+        QMutex          mutex;
+        QByteArray      input;
+        bool            last            {false};
+        bool            running         {false};
+    };
+
+    // State kept for every reply until it is finished
+
+    struct Transfer
+    {
+        Request         *request        {nullptr};
+        Inflater        inflater;
+        QByteArray      body;
+        Parse           *parse          {nullptr};
+    };
+
+    QHash<QNetworkReply *, Transfer *>  _transfers;
+    QSet<Parse *>                       _parses;
+
+    // Requests not over yet (queued, in flight or waiting to be retried),
+    // and those of them waiting in the scheduler
+
+    int                                 _requests       {0};
+    QSet<Request *>                     _queued;
+    bool                                _finishing      {false};
+
+    qint64          _bytesOnWire    {0};
+    qint64          _bytesDecoded   {0};
+    ulong           _requestsSent   {0};
+    ulong           _connections    {0};
+
+    GbRecordStore                   *_store         {nullptr};
+    RecordSink                      *_sink          {nullptr};
+    RecordCache                     *_cache         {nullptr};
+    QSet<ulong>                     *_sharedIds     {nullptr};
+    Checkpoint                      *_checkpoint    {nullptr};
+    Metrics                         *_metrics       {nullptr};
+    QElapsedTimer                   _clock;
+
+    // A shared scheduler may be deleted first (as a sibling created earlier)
+
+    QPointer<Scheduler>             _scheduler;
+    bool                            _ownsScheduler  {true};
 
-    void            fetchFromNCBI();
+    QNetworkRequest buildRequest( const QString &, const QString & );
+    void            submit( Request * );
+    void            release( Request * );
+    qint64          stamp();
+    void            report( Request *, Metrics::Outcome );
+    void            adapt( Request *, QNetworkReply *, bool );
+    bool            retry( Request *, QNetworkReply * );
+    Transfer *      startTransfer( QNetworkReply *, Request * );
+    QByteArray      decode( QNetworkReply *, Transfer * );
+    QByteArray      finishTransfer( QNetworkReply * );
+    void            fetchFromNCBI( Unit * );
+    void            fetchFromHistory( const QString &, ulong, ulong, ulong,
+                                      Unit * );
+    void            submitFetch( QString, ulong, Unit * );
+    void            postIds( const QList<ulong> &, Unit * );
+    void            fetchGiList( Unit * );
+    void            pumpFetches();
+    void            pumpHistory();
+    void            pumpIdQueue();
+    void            searchNext( ulong );
+    bool            congested();
+    bool            holdReads();
+    void            readFetch( QNetworkReply *, Transfer * );
+    void            resumeReads();
+    void            relieve();
+    ulong           searchPageSize();
+    RecordCache     *cache();
+    Projection      parseProjection();
+    void            accept( Request *, const GbRecord & );
+    void            hold( Unit *, const GbRecord & );
+    void            finishUnit( Unit * );
+    void            searchFailed( Request * );
+    void            feed( Parse *, const QByteArray &, bool );
+    void            drain( Parse * );
+    void            accept( Parse *, const QList<GbRecord> & );
+    void            fetchParsed( Parse * );
+    void            deliver( const GbRecord & );
+    void            serveFromCache( Unit * );
+    ulong           claimSharedIds();
     void            setCount( ulong );
     void            setFetchedRecords( ulong );
+    void            finish();
+    void            windDown();
 
 private slots:
     void            processESearch();
+    void            processEPost();
+    void            readReply();
+    void            readEFetch();
     void            processEFetch();
 };
 
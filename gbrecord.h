@@ -0,0 +1,71 @@
+#ifndef GBRECORD_H
+#define GBRECORD_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+// The composition of a sequence, counted by the parsers while the sequence
+// is read (see 'nucleotides.cpp')
+
+struct BaseCounts
+{
+    quint32             a               {0};
+    quint32             c               {0};
+    quint32             g               {0};
+    quint32             t               {0};
+    quint32             ambiguous       {0};    // other IUPAC codes (N, R, Y...) and U
+    quint32             gaps            {0};    // '-'
+    quint32             invalid         {0};    // anything else
+
+    void clear()
+    {
+        a = c = g = t = ambiguous = gaps = invalid = 0;
+    }
+
+    quint32 length() const
+    {
+        return a + c + g + t + ambiguous + gaps + invalid;
+    }
+
+    // GC content of the unambiguous bases
+
+    double gc() const
+    {
+        const quint32 acgt = a + c + g + t;
+        return acgt > 0 ? double( g + c ) / acgt : 0.0;
+    }
+};
+
+// A 'GbRecord' holds the fields of interest of a single <GBSeq> element of a
+// GenBank XML stream. Sequences are plain ASCII, so they are kept in a
+// QByteArray (one byte per base) instead of a UTF-16 QString. The parsers
+// strip white space and fold them to upper case.
+
+struct GbRecord
+{
+    ulong               gi              {0};
+    QString             accession       {""};
+    QString             organism        {""};
+    QString             country         {""};
+    QByteArray          sequence;
+    BaseCounts          bases;
+    QStringList         qualifiers;     // values of the qualifiers of a 'Projection'
+
+    // Reset all fields for a new record. 'resize( 0 )' keeps the memory
+    // already allocated, so that a parser reusing the same 'GbRecord' does not
+    // allocate again for every record.
+
+    void clear()
+    {
+        gi = 0;
+        accession.resize( 0 );
+        organism.resize( 0 );
+        country.resize( 0 );
+        sequence.resize( 0 );
+        bases.clear();
+        for( QString &q : qualifiers ) q.resize( 0 );
+    }
+};
+
+#endif // GBRECORD_H
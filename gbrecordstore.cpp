@@ -0,0 +1,189 @@
+#include "gbrecordstore.h"
+
+// A 'GbRecordStore' keeps the parsed fields of many GenBank records in a
+// columnar layout. Instead of a set of separately allocated QStrings for every
+// record, each column is a single buffer that grows geometrically, so that a
+// million records cost a handful of large allocations. Scanning a column (for
+// example all sequences) walks contiguous memory.
+//
+// Records are appended with 'append()' as a query delivers them (see
+// 'GbQuery::setRecordStore'), each one copied out of the 'GbRecord' it came
+// in. Holding a million 'GbRecord's would cost several allocations per
+// record; the store costs a few per column.
+//
+// The store is part of the library only: the ncbiquery executable streams
+// records to its sinks and never keeps them. The views returned by
+// 'accession' are invalidated by the next 'append'; 'sequence' returns a
+// copy.
+//
+// Identical sequences are kept once, in a 'SequenceStore'. Every record holds
+// the index of its sequence, and 'sequenceId' gives its content address.
+// With 'setPackedSequences' they take 2 bits per base.
+
+namespace
+{
+
+// Accessions and sequences are plain ASCII. Append them one byte per
+// character, without a temporary QByteArray.
+
+void appendLatin1( QByteArray &buffer, const QString &text )
+{
+    for( const QChar c : text )
+    {
+        buffer.append( c.toLatin1() );
+    }
+}
+
+}
+
+GbRecordStore::GbRecordStore()
+{
+}
+
+GbRecordStore::~GbRecordStore()
+{
+}
+
+// Keep the sequences in 2 bits per base. It must be called before the first
+// 'append', since the sequences already stored are dropped.
+
+void GbRecordStore::setPackedSequences( bool packed )
+{
+    _sequences.setPacked( packed );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'reserve' preallocates room for a number of records and sequence bytes    */
+/* when the size of a pull is known in advance (e.g., from <Count>).          */
+/*                                                                           */
+/*****************************************************************************/
+
+void GbRecordStore::reserve( qsizetype records, qsizetype sequenceBytes )
+{
+    _sequences.reserve( records, sequenceBytes );
+    _sequenceIds.reserve( records );
+    _accessions.reserve( records * 12 );
+    _accessionOffsets.reserve( records + 1 );
+    _gis.reserve( records );
+    _organisms.reserve( records );
+    _countries.reserve( records );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'append' copies the fields of a record to the end of each column and      */
+/* returns the index of the new record.                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+qsizetype GbRecordStore::append( const GbRecord &record )
+{
+    _sequenceIds.append( _sequences.intern( record.sequence ) );
+
+    appendLatin1( _accessions, record.accession );
+    _accessionOffsets.append( _accessions.size() );
+
+    _gis.append( record.gi );
+    _organisms.append( intern( record.organism ) );
+    _countries.append( intern( record.country ) );
+
+    return _gis.size() - 1;
+}
+
+void GbRecordStore::clear()
+{
+    _sequences.clear();
+    _sequenceIds.clear();
+    _accessions.clear();
+    _accessionOffsets   = {0};
+    _gis.clear();
+    _organisms.clear();
+    _countries.clear();
+    _strings            = QStringList{""};
+    _stringIndex        = {{"", 0}};
+}
+
+qsizetype GbRecordStore::size() const
+{
+    return _gis.size();
+}
+
+ulong GbRecordStore::gi( qsizetype i ) const
+{
+    return _gis.at( i );
+}
+
+// A view into the store, valid until the next 'append'
+
+QByteArrayView GbRecordStore::accession( qsizetype i ) const
+{
+    qint64 start = _accessionOffsets.at( i );
+    return QByteArrayView( _accessions.constData() + start,
+                           _accessionOffsets.at( i + 1 ) - start );
+}
+
+// A copy of the sequence (unpacked if need be)
+
+QByteArray GbRecordStore::sequence( qsizetype i ) const
+{
+    return _sequences.sequence( _sequenceIds.at( i ) );
+}
+
+// Content address of the sequence of record 'i' (see 'sequencestore.cpp')
+
+quint64 GbRecordStore::sequenceId( qsizetype i ) const
+{
+    return _sequences.id( _sequenceIds.at( i ) );
+}
+
+// The distinct sequences, with the statistics of their deduplication
+
+const SequenceStore &GbRecordStore::sequences() const
+{
+    return _sequences;
+}
+
+const QString &GbRecordStore::organism( qsizetype i ) const
+{
+    return _strings.at( _organisms.at( i ) );
+}
+
+const QString &GbRecordStore::country( qsizetype i ) const
+{
+    return _strings.at( _countries.at( i ) );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'bytes' returns the approximate amount of memory held by the store        */
+/*                                                                           */
+/*****************************************************************************/
+
+qint64 GbRecordStore::bytes() const
+{
+    qint64 total = _sequences.memory() + _accessions.capacity();
+
+    total += _sequenceIds.capacity() * sizeof( quint32 );
+    total += _accessionOffsets.capacity() * sizeof( qint64 );
+    total += _gis.capacity() * sizeof( ulong );
+    total += ( _organisms.capacity() +
+               _countries.capacity() ) * sizeof( quint32 );
+
+    for( const QString &s : _strings )
+    {
+        total += s.capacity() * sizeof( QChar );
+    }
+    return total;
+}
+
+quint32 GbRecordStore::intern( const QString &text )
+{
+    auto it = _stringIndex.constFind( text );
+    if( it != _stringIndex.constEnd() ) return it.value();
+
+    quint32 index = _strings.size();
+    _strings.append( text );
+    _stringIndex.insert( text, index );
+    return index;
+}
@@ -0,0 +1,60 @@
+#ifndef GBRECORDSTORE_H
+#define GBRECORDSTORE_H
+
+#include <QByteArrayView>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+
+#include "gbrecord.h"
+#include "sequencestore.h"
+
+class GbRecordStore
+{
+    // Variable length ASCII fields are appended to one contiguous buffer per
+    // column. Record 'i' of a column spans [ offsets[i], offsets[i + 1] ).
+
+    QByteArray          _accessions;
+    QList<qint64>       _accessionOffsets   {0};
+
+    // Sequences are deduplicated. Records keep the index of theirs in
+    // '_sequences'.
+
+    SequenceStore       _sequences;
+    QList<quint32>      _sequenceIds;
+
+    // Fixed size fields
+
+    QList<ulong>        _gis;
+
+    // Organism and country names repeat a lot. They are interned in
+    // '_strings' and records only keep their index.
+
+    QList<quint32>      _organisms;
+    QList<quint32>      _countries;
+    QStringList         _strings            {""};
+    QHash<QString, quint32> _stringIndex    {{"", 0}};
+
+    quint32             intern( const QString & );
+
+public:
+    GbRecordStore();
+    ~GbRecordStore();
+    void            setPackedSequences( bool );
+    void            reserve( qsizetype, qsizetype );
+    qsizetype       append( const GbRecord & );
+    void            clear();
+    qsizetype       size() const;
+    ulong           gi( qsizetype ) const;
+    QByteArrayView  accession( qsizetype ) const;
+    QByteArray      sequence( qsizetype ) const;
+    quint64         sequenceId( qsizetype ) const;
+    const SequenceStore & sequences() const;
+    const QString & organism( qsizetype ) const;
+    const QString & country( qsizetype ) const;
+    qint64          bytes() const;
+};
+
+#endif // GBRECORDSTORE_H
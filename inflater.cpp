@@ -0,0 +1,144 @@
+#include <zlib.h>
+
+#include <cstring>
+
+#include "inflater.h"
+
+// GenBank XML compresses very well, so every request asks NCBI for a gzip or
+// deflate encoded reply. QNetworkAccessManager would decompress such replies
+// by itself, but only if it chose the 'Accept-Encoding' header itself, and
+// then there is no way of knowing how many bytes actually travelled. Since we
+// set the header explicitly, replies arrive compressed and are decoded here,
+// chunk by chunk as they are read, which also lets us account for the bytes
+// on the wire ('bytesIn') versus the decoded bytes ('bytesOut').
+//
+// 'begin' is called with the 'Content-Encoding' header of the reply. Replies
+// that are not compressed are passed through untouched.
+
+namespace
+{
+
+const int chunkSize = 64 * 1024;
+
+}
+
+Inflater::Inflater()
+{
+}
+
+Inflater::~Inflater()
+{
+    if( _stream )
+    {
+        inflateEnd( _stream );
+        delete _stream;
+    }
+}
+
+void Inflater::begin( const QByteArray &contentEncoding )
+{
+    _started = true;
+
+    const QByteArray encoding = contentEncoding.trimmed().toLower();
+
+    if( encoding != "gzip" && encoding != "x-gzip" && encoding != "deflate" )
+    {
+        return;
+    }
+
+    _stream = new z_stream;
+    std::memset( _stream, 0, sizeof( z_stream ) );
+
+    // 15 + 32: the largest window, with automatic detection of either a gzip
+    // or a zlib header
+
+    if( inflateInit2( _stream, 15 + 32 ) != Z_OK )
+    {
+        _errorMessage = "Cannot initialize zlib";
+        _error = true;
+    }
+}
+
+bool Inflater::started()
+{
+    return _started;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'inflate' decodes a chunk of the reply and returns the decoded bytes      */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray Inflater::inflate( const QByteArray &chunk )
+{
+    _bytesIn += chunk.size();
+
+    if( !_stream )
+    {
+        _bytesOut += chunk.size();
+        return chunk;
+    }
+
+    QByteArray out;
+
+    if( _error || _ended || chunk.isEmpty() ) return out;
+
+    _stream->next_in  = reinterpret_cast<Bytef *>( const_cast<char *>( chunk.constData() ) );
+    _stream->avail_in = chunk.size();
+
+    do
+    {
+        qsizetype used = out.size();
+        out.resize( used + chunkSize );
+
+        _stream->next_out  = reinterpret_cast<Bytef *>( out.data() + used );
+        _stream->avail_out = chunkSize;
+
+        int rc = ::inflate( _stream, Z_NO_FLUSH );
+
+        out.resize( used + chunkSize - _stream->avail_out );
+
+        if( rc == Z_STREAM_END )
+        {
+            _ended = true;
+            break;
+        }
+        if( rc == Z_BUF_ERROR )
+        {
+            // No progress possible until more input arrives
+            break;
+        }
+        if( rc != Z_OK )
+        {
+            _errorMessage = QString( "zlib error: " ) +
+                            ( _stream->msg ? _stream->msg : "unknown" );
+            _error = true;
+            break;
+        }
+    }
+    while( _stream->avail_in > 0 || _stream->avail_out == 0 );
+
+    _bytesOut += out.size();
+    return out;
+}
+
+bool Inflater::hasError()
+{
+    return _error;
+}
+
+QString Inflater::errorMessage()
+{
+    return _errorMessage;
+}
+
+qint64 Inflater::bytesIn()
+{
+    return _bytesIn;
+}
+
+qint64 Inflater::bytesOut()
+{
+    return _bytesOut;
+}
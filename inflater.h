@@ -0,0 +1,33 @@
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <QByteArray>
+#include <QString>
+
+struct z_stream_s;
+
+class Inflater
+{
+    struct z_stream_s   *_stream        {nullptr};
+    bool                _started        {false};
+    bool                _ended          {false};
+    bool                _error          {false};
+    QString             _errorMessage   {"No error decoding reply"};
+    qint64              _bytesIn        {0};
+    qint64              _bytesOut       {0};
+
+public:
+    Inflater();
+    ~Inflater();
+    Inflater( const Inflater & ) = delete;
+    Inflater &      operator=( const Inflater & ) = delete;
+    void            begin( const QByteArray & );
+    bool            started();
+    QByteArray      inflate( const QByteArray & );
+    bool            hasError();
+    QString         errorMessage();
+    qint64          bytesIn();
+    qint64          bytesOut();
+};
+
+#endif // INFLATER_H
@@ -1,7 +1,64 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QUrl>
+#include <QTimer>
+#include <QThreadPool>
+#include <QCryptographicHash>
 #include <QDebug>
 
+#include "batchquery.h"
 #include "gbquery.h"
+#include "scheduler.h"
+#include "recordparser.h"
+#include "recordsink.h"
+#include "recordcache.h"
+#include "checkpoint.h"
+#include "metrics.h"
+
+// Read a list of GIs from a file, separated by white space or commas
+
+static bool readIds( const QString &fileName, QList<ulong> &ids )
+{
+    QFile file( fileName );
+
+    if( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        qDebug() << "Cannot read" << fileName << ":" << file.errorString();
+        return false;
+    }
+
+    const QList<QByteArray> fields = file.readAll().replace( ',', ' ' ).simplified().split( ' ' );
+
+    for( const QByteArray &field : fields )
+    {
+        bool  ok {false};
+        ulong gi = field.toULong( &ok );
+        if( ok ) ids.append( gi );
+    }
+    return true;
+}
+
+// The identity of a run with a checkpoint: a hash of what defines its query
+// and its output, so that options such as '--metrics' or '--concurrency' may
+// change between attempts, and the API key is not written to disk
+
+static QString checkpointIdentity( const QCommandLineParser &parser,
+                                   const QStringList &params )
+{
+    QStringList parts = params;
+
+    for( const QString &name : { "ids", "profile", "fields", "retmax", "format",
+                                 "output", "eutils" } )
+    {
+        parts << name + "=" + ( parser.isSet( name ) ? parser.value( name ) : "" );
+    }
+    parts << QString( "dedup=%1" ).arg( parser.isSet( "dedup" ) )
+          << QString( "qc=%1" ).arg( parser.isSet( "qc" ) );
+
+    return QCryptographicHash::hash( parts.join( '\n' ).toUtf8(),
+                                     QCryptographicHash::Sha256 ).toHex();
+}
 
 int main(int argc, char *argv[])
 {
@@ -12,55 +69,524 @@ int main(int argc, char *argv[])
     QString key         {""};
 
     QCoreApplication a(argc, argv);
-    if( argc > 1)
+    QCoreApplication::setApplicationName( "ncbiquery" );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Fetch DNA sequences from NCBI" );
+    parser.addHelpOption();
+    parser.addPositionalArgument( "species",
+        "Species name. Use double quotes if it includes spaces such as in "
+        "\"Munna minuta\"." );
+    parser.addPositionalArgument( "marker",
+        "Marker/gene name (COI is the default).", "[marker]" );
+    parser.addPositionalArgument( "key",
+        "NCBI's API Key.", "[api key]" );
+
+    QCommandLineOption formatOption( { "f", "format" },
+        "Output format: fasta, tsv or jsonl (default: fasta).",
+        "format", "fasta" );
+    QCommandLineOption profileOption( { "p", "profile" },
+        "Format fetched from NCBI: gb-xml (full GenBank records), fasta "
+        "(accession and sequence only) or summary (metadata only, no "
+        "sequence) (default: gb-xml).",
+        "profile", "gb-xml" );
+    QCommandLineOption outputOption( { "o", "output" },
+        "Write records to <file> instead of the standard output.",
+        "file", "-" );
+    QCommandLineOption cacheOption( { "c", "cache" },
+        "Keep fetched records in a local cache in <directory> and serve "
+        "records found there without going back to NCBI.",
+        "directory" );
+    QCommandLineOption batchOption( { "b", "batch" },
+        "Run every query listed in <file> (one 'organism<TAB>marker' per "
+        "line, optionally followed by '<TAB>profile') in this process, under a single rate limit. The species "
+        "argument is then omitted and the first argument, if any, is the "
+        "API Key.",
+        "file" );
+    QCommandLineOption idsOption( "ids",
+        "Fetch the GIs listed in <file> (separated by white space or commas) "
+        "instead of searching. The species argument is then omitted and the "
+        "first argument, if any, is the API Key.",
+        "file" );
+    QCommandLineOption keyOption( { "k", "key" },
+        "NCBI's API Key.", "key" );
+    QCommandLineOption concurrencyOption( "concurrency",
+        "Maximum number of requests in flight (default: 4).", "n", "4" );
+    QCommandLineOption activeOption( "active",
+        "Maximum number of batch queries (or shards) running at the same "
+        "time (default: 8).", "n", "8" );
+    QCommandLineOption shardOption( "shard",
+        "Split queries of more than <n> records into date ranges of at most "
+        "<n> records each, run in parallel (as a batch).", "n" );
+    QCommandLineOption shardDateOption( "shard-date",
+        "Date the shards are split on: pdat (publication) or mdat "
+        "(modification) (default: pdat).", "type", "pdat" );
+
+    QCommandLineOption retriesOption( "retries",
+        "Number of times a failed request is retried, waiting longer "
+        "every time (default: 5).", "n", "5" );
+    QCommandLineOption retMaxOption( "retmax",
+        "Number of records asked for in every request (at most 10000). By "
+        "default it starts at 200 and adapts to the latency and size of the "
+        "replies.", "n" );
+    QCommandLineOption dedupOption( "dedup",
+        "Write every distinct sequence once, under a content address that "
+        "records refer to (with fasta, the records go to '<output>.map')." );
+    QCommandLineOption fieldsOption( "fields",
+        "Extract only these fields of every record, as a comma separated "
+        "list: sequence, organism, country and any other source qualifier "
+        "(such as lat_lon, specimen_voucher, isolate or collection_date), "
+        "which adds a column (default: sequence,organism,country).", "list" );
+    QCommandLineOption qcOption( "qc",
+        "Add the length, GC content and number of ambiguous and invalid "
+        "symbols of every sequence to the output (tsv and jsonl)." );
+    QCommandLineOption checkpointOption( "checkpoint",
+        "Record the progress of the query in <file>. If the run is "
+        "interrupted, running the same command again resumes it where it "
+        "stopped. Needs --output.", "file" );
+    QCommandLineOption eutilsOption( "eutils",
+        "Send requests to the eutils server at <url> (such as a mirror, or "
+        "the mock server of ncbiquery_loadtest) instead of NCBI's.", "url" );
+    QCommandLineOption threadsOption( "parse-threads",
+        "Maximum number of threads parsing replies (default: one per core).",
+        "n" );
+    QCommandLineOption metricsOption( "metrics",
+        "Write the latency, bytes, parse time and throughput of the requests "
+        "to <file> ('-' for the standard error) when the run ends.", "file" );
+    QCommandLineOption metricsFormatOption( "metrics-format",
+        "Format of the metrics: json or prometheus (default: json).",
+        "format", "json" );
+    QCommandLineOption metricsIntervalOption( "metrics-interval",
+        "Also write the metrics every <seconds> during the run "
+        "(default: 0, only at the end).", "seconds", "0" );
+
+    parser.addOption( formatOption );
+    parser.addOption( profileOption );
+    parser.addOption( outputOption );
+    parser.addOption( cacheOption );
+    parser.addOption( batchOption );
+    parser.addOption( idsOption );
+    parser.addOption( keyOption );
+    parser.addOption( concurrencyOption );
+    parser.addOption( activeOption );
+    parser.addOption( shardOption );
+    parser.addOption( shardDateOption );
+    parser.addOption( retriesOption );
+    parser.addOption( retMaxOption );
+    parser.addOption( dedupOption );
+    parser.addOption( fieldsOption );
+    parser.addOption( qcOption );
+    parser.addOption( checkpointOption );
+    parser.addOption( eutilsOption );
+    parser.addOption( threadsOption );
+    parser.addOption( metricsOption );
+    parser.addOption( metricsFormatOption );
+    parser.addOption( metricsIntervalOption );
+
+    parser.process( a );
+
+    const QStringList args = parser.positionalArguments();
+
+    if( args.size() > 0 || parser.isSet( batchOption ) ||
+        parser.isSet( idsOption ) )
     {
-        organism = argv[1];
+        // DNS, TCP and TLS handshakes with the eutils server are done while
+        // the sink, cache and checkpoint are being set up, instead of
+        // delaying the first request. Every query runs under this scheduler.
+
+        QUrl eutils = QUrl( parser.value( eutilsOption ) );
+
+        Scheduler *scheduler = new Scheduler( &a );
+
+        if( eutils.isValid() )
+        {
+            scheduler->prewarm( eutils.scheme(), eutils.host(), eutils.port() );
+        }
+        else
+        {
+            scheduler->prewarm( "https", "eutils.ncbi.nlm.nih.gov" );
+        }
+
+        // A sharded query runs as a batch of date ranges
+
+        bool sharded = parser.isSet( shardOption ) && !parser.isSet( idsOption );
+
+        if( sharded && parser.value( shardDateOption ) != "pdat" &&
+                       parser.value( shardDateOption ) != "mdat" )
+        {
+            qDebug() << "unknown shard date" << parser.value( shardDateOption );
+            return 1;
+        }
+
+        // The number of records per request adapts, unless given
+
+        ulong maxRecords  {200};
+        bool  adaptive    {true};
 
-        // Remove any excessive white speces if present and then replace them
-        // by '+' character to be used in URLs
-        organism = organism.simplified();
-        organism.replace(" ", "+");
+        if( parser.isSet( retMaxOption ) )
+        {
+            maxRecords = qBound( 1ul, parser.value( retMaxOption ).toULong(), 10000ul );
+            adaptive   = false;
+        }
+
+        // A run with a checkpoint is identified by its query (see
+        // 'checkpointIdentity'). If the same query was interrupted before, the
+        // output is cut back to the last unit recorded as done and the run
+        // goes on from there.
+
+        Checkpoint *checkpoint {nullptr};
+        qint64      resumeAt   {-1};
+
+        if( parser.isSet( checkpointOption ) )
+        {
+            if( parser.isSet( batchOption ) || sharded )
+            {
+                qDebug() << "--checkpoint cannot be used with --batch or --shard";
+                return 1;
+            }
+            if( parser.value( outputOption ) == "-" )
+            {
+                qDebug() << "--checkpoint needs --output";
+                return 1;
+            }
+
+            // The organism and marker of a single query; the last positional
+            // argument is the API key
+
+            QStringList params;
+
+            if( !parser.isSet( idsOption ) )
+            {
+                params << "term=" + args.at( 0 ).simplified()
+                       << "marker=" + ( args.size() > 1 ? args.at( 1 ).simplified() : marker );
+            }
+
+            checkpoint = new Checkpoint( parser.value( checkpointOption ),
+                                         checkpointIdentity( parser, params ) );
+            if( checkpoint->hasError() )
+            {
+                qDebug() << checkpoint->errorMessage();
+                delete checkpoint;
+                return 1;
+            }
+            if( checkpoint->resuming() ) resumeAt = checkpoint->outputSize();
+        }
+
+        // A deduplicated FASTA output comes with a map file, which cannot
+        // be resumed
 
-        if ( argc > 2 )
+        int options {0};
+
+        if( parser.isSet( dedupOption ) ) options |= RecordSink::Dedup;
+        if( parser.isSet( qcOption ) )    options |= RecordSink::Qc;
+
+        if( ( options & RecordSink::Dedup ) && parser.value( formatOption ) == "fasta" )
         {
-            marker = argv[2];
-            marker = marker.simplified();
-            if( marker.contains(" ") )
+            if( parser.value( outputOption ) == "-" || checkpoint )
             {
-                marker = "COI";
-                qDebug() << "provide a single marker/gene name!";
+                qDebug() << "--dedup with fasta needs --output and no --checkpoint";
+                delete checkpoint;
+                return 1;
             }
         }
-        if (argc > 3)
+
+        // Only the fields asked for are parsed. FASTA has little more than
+        // the sequence to show.
+
+        Projection projection;
+
+        if( parser.isSet( fieldsOption ) )
         {
-            key = argv[3];
+            if( !Projection::fromString( parser.value( fieldsOption ), projection ) )
+            {
+                qDebug() << "invalid list of fields" << parser.value( fieldsOption );
+                delete checkpoint;
+                return 1;
+            }
+            if( parser.value( formatOption ) == "fasta" &&
+                !projection.wants( Projection::Sequence ) )
+            {
+                qDebug() << "fasta output needs the sequence field";
+                delete checkpoint;
+                return 1;
+            }
         }
 
-        ulong maxRecords  {20};
+        // Records are written as soon as they are parsed
+
+        RecordSink *sink = RecordSink::create( parser.value( formatOption ),
+                                               parser.value( outputOption ),
+                                               resumeAt, options,
+                                               projection.qualifiers() );
+        if( !sink )
+        {
+            qDebug() << "unknown output format" << parser.value( formatOption );
+            delete checkpoint;
+            return 1;
+        }
 
-        // Check if organism name has spaces and replace them by '+'
+        FetchProfile profile {FetchProfile::GbXml};
 
+        if( !RecordParser::profileFromString( parser.value( profileOption ), profile ) )
+        {
+            qDebug() << "unknown fetch profile" << parser.value( profileOption );
+            delete sink;
+            delete checkpoint;
+            return 1;
+        }
 
+        // The cache holds whole records, without the extra qualifiers of a
+        // projection (see 'GbQuery::cache')
 
-        GbQuery *ncbiquery = new GbQuery( &a );
+        RecordCache *cache {nullptr};
 
-        GbQuery::connect( ncbiquery, &GbQuery::quit,
-                          &a, &QCoreApplication::quit );
+        if( parser.isSet( cacheOption ) && !projection.qualifiers().isEmpty() )
+        {
+            qDebug() << "the cache is not used with qualifiers in --fields";
+        }
+        else if( parser.isSet( cacheOption ) )
+        {
+            cache = new RecordCache( parser.value( cacheOption ) );
+            if( cache->hasError() )
+            {
+                qDebug() << cache->errorMessage();
+                delete cache;
+                cache = nullptr;
+            }
+        }
 
-        GbQuery::connect( ncbiquery, &GbQuery::search,
-                          ncbiquery, &GbQuery::searchNCBI );
+        // Metrics are collected only if asked for, and written periodically
+        // (replacing the file) if an interval is given
 
-        ncbiquery->setQueryParams( organism, marker , key, maxRecords );
+        Metrics *metrics {nullptr};
+        QString metricsFile   = parser.value( metricsOption );
+        QString metricsFormat = parser.value( metricsFormatOption );
 
-        emit ncbiquery->search( 0 );
+        if( parser.isSet( metricsOption ) )
+        {
+            if( metricsFormat != "json" && metricsFormat != "prometheus" )
+            {
+                qDebug() << "unknown metrics format" << metricsFormat;
+                delete sink;
+                delete cache;
+                delete checkpoint;
+                return 1;
+            }
+
+            metrics = new Metrics;
+
+            int interval = parser.value( metricsIntervalOption ).toInt();
+
+            if( interval > 0 )
+            {
+                QTimer *timer = new QTimer( &a );
+                QTimer::connect( timer, &QTimer::timeout, [=]() {
+                    metrics->write( metricsFile, metricsFormat );
+                } );
+                timer->start( interval * 1000 );
+            }
+        }
+
+        // Replies are parsed on the global thread pool
+
+        if( parser.isSet( threadsOption ) )
+        {
+            QThreadPool::globalInstance()->setMaxThreadCount(
+                qMax( 1, parser.value( threadsOption ).toInt() ) );
+        }
+
+        int concurrency = parser.value( concurrencyOption ).toInt();
+        int retries     = parser.value( retriesOption ).toInt();
+
+        BatchQuery *batch     {nullptr};
+        GbQuery    *ncbiquery {nullptr};
+
+        if( parser.isSet( batchOption ) || sharded )
+        {
+            // Many queries under one shared scheduler
+
+            batch = new BatchQuery( scheduler, &a );
+
+            batch->setProfile( profile );
+            batch->setProjection( projection );
+
+            if( !parser.isSet( batchOption ) )
+            {
+                batch->addQuery( args.at( 0 ), args.size() > 1 ? args.at( 1 ) : marker );
+                if( args.size() > 2 ) key = args.at( 2 );
+            }
+            else if( !batch->load( parser.value( batchOption ) ) )
+            {
+                qDebug() << batch->errorMessage();
+                delete sink;
+                delete cache;
+                delete metrics;
+                return 1;
+            }
+            else if( args.size() > 0 )
+            {
+                key = args.at( 0 );
+            }
+            if( parser.isSet( keyOption ) ) key = parser.value( keyOption );
+
+            BatchQuery::connect( batch, &BatchQuery::quit,
+                                 &a, &QCoreApplication::quit );
+
+            batch->setQueryParams( key, maxRecords );
+            batch->setConcurrency( concurrency );
+            batch->setMaxActive( parser.value( activeOption ).toInt() );
+            batch->setRetries( retries );
+            batch->setAdaptive( adaptive );
+            batch->setMetrics( metrics );
+            if( eutils.isValid() )
+            {
+                batch->setEndpoint( eutils.scheme(), eutils.host(), eutils.port() );
+            }
+            batch->setRecordSink( sink );
+            batch->setRecordCache( cache );
+            if( sharded )
+            {
+                batch->setSharding( parser.value( shardDateOption ),
+                                    qMax( 1ul, parser.value( shardOption ).toULong() ) );
+            }
+
+            batch->start();
+        }
+        else if( parser.isSet( idsOption ) )
+        {
+            // A list of GIs, uploaded with 'epost' if it is large
+
+            QList<ulong> ids;
+
+            if( !readIds( parser.value( idsOption ), ids ) )
+            {
+                delete sink;
+                delete cache;
+                delete checkpoint;
+                delete metrics;
+                return 1;
+            }
+
+            if( args.size() > 0 ) key = args.at( 0 );
+            if( parser.isSet( keyOption ) ) key = parser.value( keyOption );
+
+            ncbiquery = new GbQuery( scheduler, &a );
+
+            GbQuery::connect( ncbiquery, &GbQuery::quit,
+                              &a, &QCoreApplication::quit );
+
+            // NCBI allows 10 requests per second with an API Key, 3 otherwise
+
+            scheduler->setRate( key != "" ? 10.0 : 3.0 );
+            scheduler->setMaxInFlight( qMax( 1, concurrency ) );
+
+            ncbiquery->setQueryParams( "", "", key, maxRecords );
+            ncbiquery->setProfile( profile );
+            ncbiquery->setProjection( projection );
+            ncbiquery->setConcurrency( concurrency );
+            ncbiquery->setRecordSink( sink );
+            ncbiquery->setRecordCache( cache );
+            ncbiquery->setRetries( retries );
+            ncbiquery->setAdaptive( adaptive );
+            ncbiquery->setMetrics( metrics );
+            if( eutils.isValid() )
+            {
+                ncbiquery->setEndpoint( eutils.scheme(), eutils.host(), eutils.port() );
+            }
+            ncbiquery->setCheckpoint( checkpoint );
+
+            ncbiquery->fetchIds( ids );
+        }
+        else
+        {
+            organism = args.at( 0 );
+
+            // Remove any excessive white speces if present and then replace
+            // them by '+' character to be used in URLs
+            organism = organism.simplified();
+            organism.replace(" ", "+");
+
+            if ( args.size() > 1 )
+            {
+                marker = args.at( 1 );
+                marker = marker.simplified();
+                if( marker.contains(" ") )
+                {
+                    marker = "COI";
+                    qDebug() << "provide a single marker/gene name!";
+                }
+            }
+            if ( args.size() > 2 )
+            {
+                key = args.at( 2 );
+            }
+            if( parser.isSet( keyOption ) ) key = parser.value( keyOption );
+
+            ncbiquery = new GbQuery( scheduler, &a );
+
+            GbQuery::connect( ncbiquery, &GbQuery::quit,
+                              &a, &QCoreApplication::quit );
+
+            GbQuery::connect( ncbiquery, &GbQuery::search,
+                              ncbiquery, &GbQuery::searchNCBI );
+
+            // NCBI allows 10 requests per second with an API Key, 3 otherwise
+
+            scheduler->setRate( key != "" ? 10.0 : 3.0 );
+            scheduler->setMaxInFlight( qMax( 1, concurrency ) );
+
+            ncbiquery->setQueryParams( organism, marker , key, maxRecords );
+            ncbiquery->setProfile( profile );
+            ncbiquery->setProjection( projection );
+            ncbiquery->setConcurrency( concurrency );
+            ncbiquery->setRecordSink( sink );
+            ncbiquery->setRecordCache( cache );
+            ncbiquery->setRetries( retries );
+            ncbiquery->setAdaptive( adaptive );
+            ncbiquery->setMetrics( metrics );
+            if( eutils.isValid() )
+            {
+                ncbiquery->setEndpoint( eutils.scheme(), eutils.host(), eutils.port() );
+            }
+            ncbiquery->setCheckpoint( checkpoint );
+
+            emit ncbiquery->search( 0 );
+        }
+
+        int status = a.exec();
+
+        if( sink->statistics() != "" ) qDebug().noquote() << sink->statistics();
+
+        delete sink;
+        delete cache;
+
+        if( metrics )
+        {
+            metrics->write( metricsFile, metricsFormat );
+            delete metrics;
+        }
+
+        // Some request was given up
+
+        if( batch ? batch->hasFailed() : ncbiquery->hasFailed() )
+        {
+            qDebug() << "Some records could not be fetched";
+            if( checkpoint ) qDebug() << "Run the same command again to resume";
+            status = 1;
+        }
+        else if( checkpoint )
+        {
+            // The query is complete
+
+            checkpoint->remove();
+        }
+        delete checkpoint;
 
-        return a.exec();
+        return status;
     }
     else
     {
         a.quit();
-        qDebug() << "usage:\n\tncbi_query <species name> [marker] [api key]";
-        qDebug() << "\nUse double quotes if species' name includes spaces such as in \"Munna minuta\"."
-                 << "You can ommit the marker/gene name (COI is the default) and the NCBI's API Key.";
+        qDebug().noquote() << parser.helpText();
     }
 }
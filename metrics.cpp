@@ -0,0 +1,306 @@
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSaveFile>
+#include <QFile>
+#include <QDebug>
+
+#include <cstdio>
+
+#include "metrics.h"
+
+// 'Metrics' aggregates what happened to every request, per endpoint: how
+// long it waited in the scheduler's queue (rate limit and in-flight limit),
+// the handshakes of a new connection (if it could not reuse one), the time to
+// the first byte of the reply (NCBI's processing plus one round trip), the
+// transfer of the rest of the reply (the network), and the time spent parsing
+// it. Durations go into histograms with fixed buckets (from 1 ms to 60 s),
+// which are cheap to update and can be merged and exported as they are. Bytes, records and the outcome of every attempt (succeeded,
+// retried or failed) are counted too, and so are the requests that opened a
+// connection and those that reused one.
+//
+// The metrics are written as JSON (with estimated quantiles) or in the text
+// format of Prometheus, at exit and optionally during the run (see 'main').
+
+namespace
+{
+
+// Upper bounds of the buckets, in seconds. The last bucket is unbounded.
+
+const double bounds[] =
+{
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0,
+    10.0, 30.0, 60.0
+};
+
+const int boundCount = sizeof( bounds ) / sizeof( bounds[0] );
+
+const char *outcomeNames[] = { "succeeded", "retried", "failed" };
+
+}
+
+void Metrics::Histogram::add( double seconds )
+{
+    if( counts.isEmpty() ) counts.resize( boundCount + 1 );
+
+    int i = 0;
+    while( i < boundCount && seconds > bounds[i] ) i++;
+
+    counts[i]++;
+    count++;
+    sum += seconds;
+}
+
+// Estimate of a quantile, interpolating linearly inside its bucket
+
+double Metrics::Histogram::quantile( double q ) const
+{
+    if( count == 0 ) return 0.0;
+
+    double rank  = q * count;
+    qint64 below = 0;
+
+    for( int i = 0; i <= boundCount; ++i )
+    {
+        if( below + counts.at( i ) >= rank )
+        {
+            double lower = i > 0 ? bounds[i - 1] : 0.0;
+            if( i == boundCount ) return lower;
+
+            double upper = bounds[i];
+            return lower + ( upper - lower ) * ( rank - below ) / counts.at( i );
+        }
+        below += counts.at( i );
+    }
+    return bounds[boundCount - 1];
+}
+
+Metrics::Metrics()
+{
+    _clock.start();
+}
+
+Metrics::~Metrics()
+{
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'add' accounts for an attempt of a request to 'endpoint'                  */
+/*                                                                           */
+/*****************************************************************************/
+
+void Metrics::add( const char *endpoint, const Sample &s, Outcome outcome )
+{
+    Endpoint &e = _endpoints[ QString::fromLatin1( endpoint ) ];
+
+    e.outcomes[outcome]++;
+    e.bytesOnWire  += s.bytesOnWire;
+    e.bytesDecoded += s.bytesDecoded;
+    e.records      += s.records;
+
+    // A reply without a body has no first byte; it all counts as waiting
+
+    qint64 firstByte = s.firstByte > 0 ? s.firstByte : s.finished;
+
+    // The time to the first byte of a request that opened a connection
+    // starts once the connection is up
+
+    qint64 sent = s.started;
+
+    if( s.connecting > 0 )
+    {
+        sent = s.connected > 0 ? s.connected : firstByte;
+        e.connections++;
+        e.handshake.add( ( sent - s.connecting ) / 1e9 );
+    }
+    else
+    {
+        e.reused++;
+    }
+
+    e.queue.add( ( s.started - s.queued ) / 1e9 );
+    e.ttfb.add( ( firstByte - sent ) / 1e9 );
+    e.transfer.add( ( s.finished - firstByte ) / 1e9 );
+    e.parse.add( s.parse / 1e9 );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'toJson' writes the metrics as a JSON object                              */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray Metrics::toJson()
+{
+    auto histogram = []( const Histogram &h ) {
+        QJsonObject o;
+        QJsonArray  buckets;
+
+        for( int i = 0; i < h.counts.size(); ++i )
+        {
+            QJsonObject b;
+            b["le"]    = i < boundCount ? QJsonValue( bounds[i] ) : QJsonValue( "+Inf" );
+            b["count"] = double( h.counts.at( i ) );
+            buckets.append( b );
+        }
+
+        o["count"]   = double( h.count );
+        o["sum"]     = h.sum;
+        o["p50"]     = h.quantile( 0.50 );
+        o["p90"]     = h.quantile( 0.90 );
+        o["p99"]     = h.quantile( 0.99 );
+        o["buckets"] = buckets;
+        return o;
+    };
+
+    double      uptime  = _clock.nsecsElapsed() / 1e9;
+    qint64      records {0};
+    qint64      bytes   {0};
+    QJsonObject endpoints;
+
+    for( auto it = _endpoints.cbegin(); it != _endpoints.cend(); ++it )
+    {
+        const Endpoint &e = it.value();
+        QJsonObject     o;
+
+        for( int i = 0; i < 3; ++i ) o[ outcomeNames[i] ] = double( e.outcomes[i] );
+
+        o["bytes_on_wire"]   = double( e.bytesOnWire );
+        o["bytes_decoded"]   = double( e.bytesDecoded );
+        o["records"]         = double( e.records );
+        o["connections_opened"] = double( e.connections );
+        o["connections_reused"] = double( e.reused );
+        o["queue_seconds"]   = histogram( e.queue );
+        o["handshake_seconds"] = histogram( e.handshake );
+        o["ttfb_seconds"]    = histogram( e.ttfb );
+        o["transfer_seconds"] = histogram( e.transfer );
+        o["parse_seconds"]   = histogram( e.parse );
+
+        endpoints[ it.key() ] = o;
+
+        bytes += e.bytesOnWire;
+        if( it.key() != "esearch" ) records += e.records;
+    }
+
+    QJsonObject root;
+
+    root["uptime_seconds"]    = uptime;
+    root["records"]           = double( records );
+    root["records_per_second"] = uptime > 0 ? records / uptime : 0.0;
+    root["bytes_per_second"]  = uptime > 0 ? bytes / uptime : 0.0;
+    root["endpoints"]         = endpoints;
+
+    return QJsonDocument( root ).toJson( QJsonDocument::Indented );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'toPrometheus' writes the metrics in the Prometheus text format           */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray Metrics::toPrometheus()
+{
+    QByteArray out;
+
+    auto counter = [&out, this]( const char *name, const char *help,
+                                 qint64 Endpoint::*field ) {
+        out += QByteArray( "# HELP ncbiquery_" ) + name + ' ' + help + '\n';
+        out += QByteArray( "# TYPE ncbiquery_" ) + name + " counter\n";
+        for( auto it = _endpoints.cbegin(); it != _endpoints.cend(); ++it )
+        {
+            out += QByteArray( "ncbiquery_" ) + name + "{endpoint=\"" + it.key().toLatin1()
+                 + "\"} " + QByteArray::number( it.value().*field ) + '\n';
+        }
+    };
+
+    auto histogram = [&out, this]( const char *name, const char *help,
+                                   Histogram Endpoint::*field ) {
+        out += QByteArray( "# HELP ncbiquery_" ) + name + ' ' + help + '\n';
+        out += QByteArray( "# TYPE ncbiquery_" ) + name + " histogram\n";
+        for( auto it = _endpoints.cbegin(); it != _endpoints.cend(); ++it )
+        {
+            const Histogram  &h     = it.value().*field;
+            const QByteArray labels = "endpoint=\"" + it.key().toLatin1() + '"';
+            qint64           total  {0};
+
+            for( int i = 0; i < h.counts.size(); ++i )
+            {
+                total += h.counts.at( i );
+                out += QByteArray( "ncbiquery_" ) + name + "_bucket{" + labels + ",le=\""
+                     + ( i < boundCount ? QByteArray::number( bounds[i] ) : "+Inf" )
+                     + "\"} " + QByteArray::number( total ) + '\n';
+            }
+            out += QByteArray( "ncbiquery_" ) + name + "_sum{" + labels + "} "
+                 + QByteArray::number( h.sum, 'g', 9 ) + '\n';
+            out += QByteArray( "ncbiquery_" ) + name + "_count{" + labels + "} "
+                 + QByteArray::number( h.count ) + '\n';
+        }
+    };
+
+    out += "# HELP ncbiquery_requests_total Attempts of requests by outcome.\n"
+           "# TYPE ncbiquery_requests_total counter\n";
+    for( auto it = _endpoints.cbegin(); it != _endpoints.cend(); ++it )
+    {
+        for( int i = 0; i < 3; ++i )
+        {
+            out += "ncbiquery_requests_total{endpoint=\"" + it.key().toLatin1()
+                 + "\",outcome=\"" + outcomeNames[i] + "\"} "
+                 + QByteArray::number( it.value().outcomes[i] ) + '\n';
+        }
+    }
+
+    counter( "bytes_on_wire_total", "Bytes received, before decompression.",
+             &Endpoint::bytesOnWire );
+    counter( "bytes_decoded_total", "Bytes received, after decompression.",
+             &Endpoint::bytesDecoded );
+    counter( "records_total", "Records (or IDs) parsed.", &Endpoint::records );
+    counter( "connections_opened_total", "Requests that opened a connection.",
+             &Endpoint::connections );
+    counter( "connections_reused_total", "Requests that reused a connection.",
+             &Endpoint::reused );
+
+    histogram( "queue_seconds", "Time waiting in the scheduler.", &Endpoint::queue );
+    histogram( "handshake_seconds", "Time opening a connection (DNS, TCP and TLS).",
+               &Endpoint::handshake );
+    histogram( "ttfb_seconds", "Time to the first byte of the reply.", &Endpoint::ttfb );
+    histogram( "transfer_seconds", "Time from the first to the last byte.",
+               &Endpoint::transfer );
+    histogram( "parse_seconds", "Time spent parsing the reply.", &Endpoint::parse );
+
+    out += "# HELP ncbiquery_uptime_seconds Time since the start of the run.\n"
+           "# TYPE ncbiquery_uptime_seconds gauge\n"
+           "ncbiquery_uptime_seconds " + QByteArray::number( _clock.nsecsElapsed() / 1e9, 'g', 9 ) + '\n';
+
+    return out;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'write' writes the metrics in 'format' ("json" or "prometheus") to a file */
+/* (the standard error if "-"). The file is replaced atomically, so that it  */
+/* can be read at any time during the run.                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+bool Metrics::write( const QString &fileName, const QString &format )
+{
+    const QByteArray data = format == "prometheus" ? toPrometheus() : toJson();
+
+    if( fileName == "-" )
+    {
+        QFile file;
+        return file.open( stderr, QIODevice::WriteOnly ) && file.write( data ) == data.size();
+    }
+
+    QSaveFile file( fileName );
+
+    if( !file.open( QIODevice::WriteOnly ) )
+    {
+        qDebug() << "Cannot write metrics:" << file.errorString();
+        return false;
+    }
+    file.write( data );
+    return file.commit();
+}
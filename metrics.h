@@ -0,0 +1,77 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QMap>
+
+class Metrics
+{
+public:
+    enum Outcome
+    {
+        Succeeded,
+        Retried,
+        Failed
+    };
+
+    // What happened to a single attempt of a request. Times are taken on
+    // the clock of the query; 'parse' is a duration. All of them are in
+    // nanoseconds. 'connecting' and 'connected' bound the setup of a new
+    // connection (DNS, TCP and TLS) and are 0 if the request reused one.
+
+    struct Sample
+    {
+        qint64          queued          {0};
+        qint64          started         {0};
+        qint64          connecting      {0};
+        qint64          connected       {0};
+        qint64          firstByte       {0};
+        qint64          finished        {0};
+        qint64          parse           {0};
+        qint64          bytesOnWire     {0};
+        qint64          bytesDecoded    {0};
+        qint64          records         {0};
+    };
+
+private:
+    struct Histogram
+    {
+        QList<qint64>   counts;
+        qint64          count           {0};
+        double          sum             {0.0};
+
+        void            add( double );
+        double          quantile( double ) const;
+    };
+
+    struct Endpoint
+    {
+        qint64          outcomes[3]     {0, 0, 0};
+        qint64          bytesOnWire     {0};
+        qint64          bytesDecoded    {0};
+        qint64          records         {0};
+        qint64          connections     {0};
+        qint64          reused          {0};
+        Histogram       queue;
+        Histogram       handshake;
+        Histogram       ttfb;
+        Histogram       transfer;
+        Histogram       parse;
+    };
+
+    QMap<QString, Endpoint>     _endpoints;
+    QElapsedTimer               _clock;
+
+public:
+    Metrics();
+    ~Metrics();
+    void            add( const char *, const Sample &, Outcome );
+    QByteArray      toJson();
+    QByteArray      toPrometheus();
+    bool            write( const QString &, const QString & );
+};
+
+#endif // METRICS_H
@@ -0,0 +1,32 @@
+#ifndef NCBIQUERY_H
+#define NCBIQUERY_H
+
+// The public interface of libncbiquery, for programs that embed GenBank
+// queries instead of running the ncbiquery executable:
+//
+// RecordStream    runs a query and streams its records (recordstream.h)
+// GbQuery         the query itself: search terms, profile, projection,
+//                 cache, checkpoint, metrics (gbquery.h)
+// Scheduler       rate limit and requests in flight, shared by queries
+// GbRecord        a parsed record
+// GbRecordStore   many records in columns, with deduplicated sequences
+// Projection      the fields of the records to extract
+// Esearch, Efetch the parsers of 'esearch' and GenBank XML replies, for
+//                 replies obtained by other means
+//
+// Everything declared here keeps its signature within a major version of
+// the interface. The other headers of the source tree are internal.
+
+#define NCBIQUERY_API_VERSION 1
+
+#include "gbrecord.h"
+#include "gbrecordstore.h"
+#include "projection.h"
+#include "recordparser.h"
+#include "esearch.h"
+#include "efetch.h"
+#include "scheduler.h"
+#include "gbquery.h"
+#include "recordstream.h"
+
+#endif // NCBIQUERY_H
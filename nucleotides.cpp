@@ -0,0 +1,310 @@
+#include <QtEndian>
+#include <QtAlgorithms>
+
+#include <cstring>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include "nucleotides.h"
+
+// Sequences arrive as text: lower case lines of bases separated by white
+// space in GenBank XML (UTF-16, as QXmlStreamReader hands it over), upper
+// case lines in FASTA. 'append' turns such text into bases in a single pass:
+// white space is dropped, letters are folded to upper case, and every symbol
+// is checked against the IUPAC alphabet and counted (A, C, G, T, ambiguity
+// codes, gaps and invalid symbols) in the 'BaseCounts' of the record, which
+// gives its length, GC content and ambiguity for free.
+//
+// With SSE2 (every x86-64 CPU) 16 symbols are handled at a time: they are
+// folded to upper case and compared with A, C, G and T, and the bases found
+// are counted from the comparison masks. A block of nothing but A, C, G and
+// T (almost every block of a sequence) is stored as it is. Blocks with white
+// space (at the end of a line) or with other symbols go through a table, one
+// symbol at a time. UTF-16 text is narrowed to bytes, and any character
+// beyond Latin-1 becomes 0xff, an invalid symbol, with or without SSE2.
+//
+// 'pack' stores a sequence in 2 bits per base, four bases per byte. The code
+// of a base is taken from bits 1 and 2 of its ASCII code (A 0, C 1, T 2, G 3,
+// in upper or lower case), eight symbols at a time. Symbols other than A, C,
+// G and T get whatever code their ASCII code gives and are recorded as runs
+// ('Run'), since they are rare and usually come in runs (NNNN...). 'unpack'
+// restores the sequence in upper case, writing the runs over the codes.
+
+namespace
+{
+
+// Classes of symbols
+
+enum Class : quint8
+{
+    Space,
+    BaseA,
+    BaseC,
+    BaseG,
+    BaseT,
+    Ambiguous,
+    Gap,
+    Invalid
+};
+
+struct Alphabet
+{
+    quint8      classes[256];
+    char        upper[256];
+
+    Alphabet()
+    {
+        for( int i = 0; i < 256; ++i )
+        {
+            classes[i] = Invalid;
+            upper[i]   = char( i >= 'a' && i <= 'z' ? i - ( 'a' - 'A' ) : i );
+        }
+        for( const char *p = "RYKMSWBDHVNU"; *p; ++p )
+        {
+            classes[ quint8( *p ) ]            = Ambiguous;
+            classes[ quint8( *p + 'a' - 'A' ) ] = Ambiguous;
+        }
+        const char *bases = "ACGT";
+        for( int i = 0; i < 4; ++i )
+        {
+            classes[ quint8( bases[i] ) ]                = quint8( BaseA + i );
+            classes[ quint8( bases[i] + 'a' - 'A' ) ]    = quint8( BaseA + i );
+        }
+        classes[ quint8( '-' ) ]  = Gap;
+        classes[ quint8( ' ' ) ]  = Space;
+        classes[ quint8( '\t' ) ] = Space;
+        classes[ quint8( '\n' ) ] = Space;
+        classes[ quint8( '\r' ) ] = Space;
+    }
+};
+
+const Alphabet alphabet;
+
+// One symbol at a time. It returns the number of bytes written (0 or 1).
+
+inline qsizetype symbol( quint8 b, char *out, BaseCounts &counts )
+{
+    switch( alphabet.classes[b] )
+    {
+        case Space:     return 0;
+        case BaseA:     counts.a++;         break;
+        case BaseC:     counts.c++;         break;
+        case BaseG:     counts.g++;         break;
+        case BaseT:     counts.t++;         break;
+        case Ambiguous: counts.ambiguous++; break;
+        case Gap:       counts.gaps++;      break;
+        default:        counts.invalid++;   break;
+    }
+    *out = alphabet.upper[b];
+    return 1;
+}
+
+#if defined( __SSE2__ )
+
+// 16 symbols at a time. It returns the number of bytes written.
+
+inline qsizetype block( __m128i x, char *out, BaseCounts &counts )
+{
+    const __m128i lower = _mm_and_si128( _mm_cmpgt_epi8( x, _mm_set1_epi8( 'a' - 1 ) ),
+                                         _mm_cmplt_epi8( x, _mm_set1_epi8( 'z' + 1 ) ) );
+    const __m128i up    = _mm_sub_epi8( x, _mm_and_si128( lower, _mm_set1_epi8( 0x20 ) ) );
+
+    const quint32 a = _mm_movemask_epi8( _mm_cmpeq_epi8( up, _mm_set1_epi8( 'A' ) ) );
+    const quint32 c = _mm_movemask_epi8( _mm_cmpeq_epi8( up, _mm_set1_epi8( 'C' ) ) );
+    const quint32 g = _mm_movemask_epi8( _mm_cmpeq_epi8( up, _mm_set1_epi8( 'G' ) ) );
+    const quint32 t = _mm_movemask_epi8( _mm_cmpeq_epi8( up, _mm_set1_epi8( 'T' ) ) );
+
+    if( ( a | c | g | t ) == 0xffff )
+    {
+        _mm_storeu_si128( reinterpret_cast<__m128i *>( out ), up );
+        counts.a += qPopulationCount( a );
+        counts.c += qPopulationCount( c );
+        counts.g += qPopulationCount( g );
+        counts.t += qPopulationCount( t );
+        return 16;
+    }
+
+    alignas( 16 ) quint8 bytes[16];
+    _mm_store_si128( reinterpret_cast<__m128i *>( bytes ), x );
+
+    qsizetype n {0};
+    for( int i = 0; i < 16; ++i ) n += symbol( bytes[i], out + n, counts );
+    return n;
+}
+
+#endif
+
+// Bytes and UTF-16 text go through the same blocks; UTF-16 is narrowed to
+// bytes first
+
+qsizetype normalize( const char *in, qsizetype size, char *out, BaseCounts &counts )
+{
+    qsizetype i {0};
+    qsizetype n {0};
+
+#if defined( __SSE2__ )
+    for( ; i + 16 <= size; i += 16 )
+    {
+        n += block( _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) ),
+                    out + n, counts );
+    }
+#endif
+
+    for( ; i < size; ++i ) n += symbol( quint8( in[i] ), out + n, counts );
+    return n;
+}
+
+qsizetype normalize( const char16_t *in, qsizetype size, char *out, BaseCounts &counts )
+{
+    qsizetype i {0};
+    qsizetype n {0};
+
+#if defined( __SSE2__ )
+    // The pack saturates signed words, so code units of 0x8000 and above
+    // would become 0. They are first clamped (unsigned) to 0xff: x - (x - 0xff)
+    // with saturating subtractions is min( x, 0xff ).
+
+    const __m128i latin1 = _mm_set1_epi16( 0xff );
+
+    for( ; i + 16 <= size; i += 16 )
+    {
+        __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+        __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i + 8 ) );
+        lo = _mm_subs_epu16( lo, _mm_subs_epu16( lo, latin1 ) );
+        hi = _mm_subs_epu16( hi, _mm_subs_epu16( hi, latin1 ) );
+        n += block( _mm_packus_epi16( lo, hi ), out + n, counts );
+    }
+#endif
+
+    for( ; i < size; ++i )
+    {
+        n += symbol( in[i] < 0x100 ? quint8( in[i] ) : quint8( 0xff ), out + n, counts );
+    }
+    return n;
+}
+
+// The 2 bit codes of eight symbols, packed in the low 16 bits
+
+inline quint32 packWord( quint64 w )
+{
+    w = ( w >> 1 ) & 0x0303030303030303ull;
+    w = ( w | ( w >> 6 ) )  & 0x000f000f000f000full;
+    w = ( w | ( w >> 12 ) ) & 0x000000ff000000ffull;
+    return quint32( ( w | ( w >> 24 ) ) & 0xffff );
+}
+
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'append' appends the bases of 'text' to 'sequence' and counts them        */
+/*                                                                           */
+/*****************************************************************************/
+
+void Nucleotides::append( QByteArray &sequence, QByteArrayView text, BaseCounts &counts )
+{
+    const qsizetype start = sequence.size();
+
+    sequence.resize( start + text.size() );
+    sequence.resize( start + ::normalize( text.data(), text.size(),
+                                          sequence.data() + start, counts ) );
+}
+
+void Nucleotides::append( QByteArray &sequence, QStringView text, BaseCounts &counts )
+{
+    const qsizetype start = sequence.size();
+
+    sequence.resize( start + text.size() );
+    sequence.resize( start + ::normalize( text.utf16(), text.size(),
+                                          sequence.data() + start, counts ) );
+}
+
+// 'normalize' does the same in place, for a sequence that did not come from
+// a parser (from the cache, for example)
+
+void Nucleotides::normalize( QByteArray &sequence, BaseCounts &counts )
+{
+    char *data = sequence.data();
+
+    counts.clear();
+    sequence.resize( ::normalize( data, sequence.size(), data, counts ) );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'pack' appends the 2 bit codes of 'sequence' to 'packed' and its runs of  */
+/* other symbols to 'runs' (with positions relative to the sequence)         */
+/*                                                                           */
+/*****************************************************************************/
+
+qsizetype Nucleotides::packedSize( qsizetype bases )
+{
+    return ( bases + 3 ) / 4;
+}
+
+void Nucleotides::pack( QByteArrayView sequence, QByteArray &packed, QList<Run> &runs )
+{
+    const char     *p = sequence.data();
+    const qsizetype n = sequence.size();
+
+    qsizetype out = packed.size();
+    packed.resize( out + packedSize( n ) );
+    char *q = packed.data() + out;
+
+    qsizetype i {0};
+
+    for( ; i + 8 <= n; i += 8 )
+    {
+        const quint32 codes = packWord( qFromLittleEndian<quint64>( p + i ) );
+        *q++ = char( codes & 0xff );
+        *q++ = char( codes >> 8 );
+    }
+
+    if( i < n )
+    {
+        char tail[8] {'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A'};
+        std::memcpy( tail, p + i, n - i );
+        const quint32 codes = packWord( qFromLittleEndian<quint64>( tail ) );
+        *q++ = char( codes & 0xff );
+        if( n - i > 4 ) *q++ = char( codes >> 8 );
+    }
+
+    // Runs of other symbols
+
+    for( i = 0; i < n; ++i )
+    {
+        const quint8 c = alphabet.classes[ quint8( p[i] ) ];
+        if( c >= BaseA && c <= BaseT ) continue;
+
+        const char base = alphabet.upper[ quint8( p[i] ) ];
+
+        qsizetype end = i + 1;
+        while( end < n && alphabet.upper[ quint8( p[end] ) ] == base ) end++;
+
+        runs.append( Run{ quint32( i ), quint32( end - i ), base } );
+        i = end - 1;
+    }
+}
+
+QByteArray Nucleotides::unpack( const char *packed, qsizetype bases,
+                                const Run *runs, qsizetype runCount )
+{
+    static const char symbols[4] = {'A', 'C', 'T', 'G'};
+
+    QByteArray sequence( bases, Qt::Uninitialized );
+    char *out = sequence.data();
+
+    for( qsizetype i = 0; i < bases; ++i )
+    {
+        out[i] = symbols[ ( quint8( packed[i >> 2] ) >> ( 2 * ( i & 3 ) ) ) & 3 ];
+    }
+
+    for( qsizetype r = 0; r < runCount; ++r )
+    {
+        std::memset( out + runs[r].start, runs[r].base, runs[r].length );
+    }
+
+    return sequence;
+}
@@ -0,0 +1,31 @@
+#ifndef NUCLEOTIDES_H
+#define NUCLEOTIDES_H
+
+#include <QByteArrayView>
+#include <QByteArray>
+#include <QStringView>
+#include <QList>
+
+#include "gbrecord.h"
+
+namespace Nucleotides
+{
+    // A run of symbols other than A, C, G and T in a packed sequence
+
+    struct Run
+    {
+        quint32         start           {0};
+        quint32         length          {0};
+        char            base            {'N'};
+    };
+
+    void            append( QByteArray &, QByteArrayView, BaseCounts & );
+    void            append( QByteArray &, QStringView, BaseCounts & );
+    void            normalize( QByteArray &, BaseCounts & );
+
+    void            pack( QByteArrayView, QByteArray &, QList<Run> & );
+    QByteArray      unpack( const char *, qsizetype, const Run *, qsizetype );
+    qsizetype       packedSize( qsizetype );
+}
+
+#endif // NUCLEOTIDES_H
@@ -0,0 +1,94 @@
+#include "projection.h"
+
+// A 'Projection' lists the fields of a record that are of interest: the
+// sequence, the organism, the country, and any other source qualifier by name
+// (such as "lat_lon", "specimen_voucher", "isolate" or "collection_date").
+// The parsers extract only these, and the GenBank XML parser skips every
+// subtree that cannot hold one of them (see 'efetch.cpp'), so that parsing
+// costs what is asked for rather than what the record carries.
+//
+// The values of the extra qualifiers go to 'GbRecord::qualifiers', in the
+// order they were added to the projection.
+
+Projection::Projection()
+{
+}
+
+Projection::~Projection()
+{
+}
+
+void Projection::setFields( int fields )
+{
+    _fields = fields & All;
+}
+
+int Projection::fields() const
+{
+    return _fields;
+}
+
+bool Projection::wants( Field field ) const
+{
+    return _fields & field;
+}
+
+void Projection::addQualifier( const QString &name )
+{
+    if( !_qualifiers.contains( name ) ) _qualifiers.append( name );
+}
+
+const QStringList &Projection::qualifiers() const
+{
+    return _qualifiers;
+}
+
+// The index of a qualifier in 'GbRecord::qualifiers', or -1 if it is not
+// projected. There are only a handful of them, so a linear search will do.
+
+qsizetype Projection::qualifier( QStringView name ) const
+{
+    for( qsizetype i = 0; i < _qualifiers.size(); ++i )
+    {
+        if( name == _qualifiers.at( i ) ) return i;
+    }
+    return -1;
+}
+
+// Whether the feature table has to be read at all
+
+bool Projection::needsQualifiers() const
+{
+    return ( _fields & ( Organism | Country ) ) || !_qualifiers.isEmpty();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'fromString' reads a comma separated list of fields, as given with        */
+/* '--fields'. "sequence", "organism" and "country" are fields of every      */
+/* record; any other name is taken as a source qualifier. "accession" and    */
+/* "gi" are accepted, although they are always extracted.                    */
+/*                                                                           */
+/*****************************************************************************/
+
+bool Projection::fromString( const QString &list, Projection &projection )
+{
+    Projection p;
+    int        fields {0};
+
+    for( const QString &item : list.split( ',', Qt::SkipEmptyParts ) )
+    {
+        const QString name = item.trimmed();
+
+        if( name == "sequence" )                        fields |= Sequence;
+        else if( name == "organism" )                   fields |= Organism;
+        else if( name == "country" )                    fields |= Country;
+        else if( name == "accession" || name == "gi" )  continue;
+        else if( name.isEmpty() || name.contains( '|' ) ) return false;
+        else p.addQualifier( name );
+    }
+
+    p.setFields( fields );
+    projection = p;
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+
+// The fields of a record a query asks for. The accession and the GI are
+// always extracted.
+
+class Projection
+{
+public:
+    enum Field
+    {
+        Sequence    = 0x1,
+        Organism    = 0x2,
+        Country     = 0x4,
+        All         = Sequence | Organism | Country
+    };
+
+private:
+    int                 _fields         {All};
+    QStringList         _qualifiers;
+
+public:
+    Projection();
+    ~Projection();
+    void                setFields( int );
+    int                 fields() const;
+    bool                wants( Field ) const;
+    void                addQualifier( const QString & );
+    const QStringList & qualifiers() const;
+    qsizetype           qualifier( QStringView ) const;
+    bool                needsQualifiers() const;
+
+    static bool         fromString( const QString &, Projection & );
+};
+
+#endif // PROJECTION_H
@@ -0,0 +1,682 @@
+#include <QDataStream>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QDir>
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+
+#include "recordcache.h"
+
+// A 'RecordCache' keeps every record ever fetched in a local directory, so
+// that repeated pulls of the same organism/marker do not go back to NCBI for
+// records downloaded before. The directory holds three files:
+//
+// records.dat  the records themselves, appended one after another as a
+//              32-bit length followed by the record serialized with
+//              QDataStream (the fields of 'GbRecord', with the sequence
+//              normalized and its base counts). This file is only ever
+//              appended to (but for a torn last record, see 'load'), so an
+//              offset into it stays valid forever.
+//
+// gi.idx       a header followed by (GI, offset) pairs sorted by GI
+//
+// acc.idx      a header followed by (accession.version, offset) pairs sorted
+//              by accession (zero padded to 24 bytes)
+//
+// The index files are memory mapped and searched in place with a binary
+// search, so opening a cache of millions of records costs nothing. The header
+// of an index records how much of 'records.dat' it covers.
+//
+// The cache may be shared by several processes. Every write happens while
+// holding a QLockFile ('lock'): records are appended to 'records.dat' and
+// indexes are rewritten to a temporary file (QSaveFile) that atomically
+// replaces the old one. A process that still has the old index mapped keeps
+// reading a consistent (if slightly outdated) snapshot. Records that were
+// appended but never indexed (e.g., the process was killed before 'sync') are
+// recovered by scanning 'records.dat' past the size covered by the index.
+// A record torn by a process killed in the middle of 'commit' is cut off
+// when the cache is next opened (or by the next 'commit' of a process that
+// has it open), so that the records appended after it can be read.
+//
+// Records inserted during a run are kept in a memory journal and written out
+// by 'commit' (GbQuery calls it after each 'efetch' reply), and indexed by
+// 'sync' (called when the cache is destroyed).
+
+namespace
+{
+
+const char giMagic[]  = "NQGIIDX1";
+const char accMagic[] = "NQACIDX1";
+
+}
+
+RecordCache::RecordCache( const QString &directory )
+    : _directory( directory )
+{
+    qDebug() << "Constructing RecordCache";
+
+    if( !QDir().mkpath( directory ) )
+    {
+        _errorMessage = "Cannot create cache directory " + directory;
+        _error = true;
+        return;
+    }
+
+    QLockFile lock( path( "lock" ) );
+    if( !lock.lock() )
+    {
+        _errorMessage = "Cannot lock cache directory " + directory;
+        _error = true;
+        return;
+    }
+
+    load();
+}
+
+RecordCache::~RecordCache()
+{
+    qDebug() << "Destructing RecordCache";
+    sync();
+    unload();
+}
+
+bool RecordCache::hasError()
+{
+    return _error;
+}
+
+QString RecordCache::errorMessage()
+{
+    return _errorMessage;
+}
+
+QString RecordCache::path( const QString &name )
+{
+    return QDir( _directory ).filePath( name );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'load' maps the current data and index files, and recovers records that  */
+/* were appended to the data file but are not in the indexes. It must be     */
+/* called while holding the lock.                                            */
+/*                                                                           */
+/*****************************************************************************/
+
+void RecordCache::load()
+{
+    quint64 indexed {0};
+
+    unload();
+
+    _giFile.setFileName( path( "gi.idx" ) );
+    if( _giFile.open( QIODevice::ReadOnly ) &&
+        _giFile.size() >= qint64( sizeof( IndexHeader ) ) )
+    {
+        _giMap = _giFile.map( 0, _giFile.size() );
+        const IndexHeader *header = reinterpret_cast<const IndexHeader *>( _giMap );
+        if( _giMap && std::memcmp( header->magic, giMagic, 8 ) == 0 )
+        {
+            indexed  = header->dataSize;
+            _gis     = reinterpret_cast<const GiEntry *>( _giMap + sizeof( IndexHeader ) );
+            _giCount = ( _giFile.size() - sizeof( IndexHeader ) ) / sizeof( GiEntry );
+        }
+    }
+
+    _accFile.setFileName( path( "acc.idx" ) );
+    if( _accFile.open( QIODevice::ReadOnly ) &&
+        _accFile.size() >= qint64( sizeof( IndexHeader ) ) )
+    {
+        _accMap = _accFile.map( 0, _accFile.size() );
+        const IndexHeader *header = reinterpret_cast<const IndexHeader *>( _accMap );
+        if( _accMap && std::memcmp( header->magic, accMagic, 8 ) == 0 )
+        {
+            indexed   = qMin( indexed, header->dataSize );
+            _accs     = reinterpret_cast<const AccEntry *>( _accMap + sizeof( IndexHeader ) );
+            _accCount = ( _accFile.size() - sizeof( IndexHeader ) ) / sizeof( AccEntry );
+        }
+        else
+        {
+            indexed   = 0;
+        }
+    }
+    else
+    {
+        indexed = 0;
+    }
+
+    _dataFile.setFileName( path( "records.dat" ) );
+    if( _dataFile.open( QIODevice::ReadOnly ) && _dataFile.size() > 0 )
+    {
+        _dataMapSize = _dataFile.size();
+        _dataMap     = _dataFile.map( 0, _dataMapSize );
+        if( !_dataMap ) _dataMapSize = 0;
+    }
+
+    // If both indexes are missing or unreadable 'indexed' is zero and the
+    // whole data file is scanned
+
+    _covered = scan( indexed );
+
+    // Whatever 'scan' could not read is what is left of a 'commit' that was
+    // killed (nobody else writes while the lock is held). Nothing past it
+    // could ever be read, so it is cut off before anything is appended.
+
+    if( _covered < _dataMapSize )
+    {
+        QFile data( path( "records.dat" ) );
+
+        qDebug() << "Dropping" << _dataMapSize - _covered
+                 << "bytes of a torn record from the record cache";
+
+        if( data.open( QIODevice::ReadWrite ) && data.resize( _covered ) )
+        {
+            _dataMapSize = _covered;
+        }
+        else
+        {
+            qDebug() << "Cannot repair record cache:" << data.errorString();
+        }
+    }
+
+    _validEnd = _covered;
+    _seenSize = _dataMapSize;
+}
+
+void RecordCache::unload()
+{
+    if( _dataMap ) _dataFile.unmap( _dataMap );
+    if( _giMap )   _giFile.unmap( _giMap );
+    if( _accMap )  _accFile.unmap( _accMap );
+
+    _dataFile.close();
+    _giFile.close();
+    _accFile.close();
+
+    _dataMap     = nullptr;
+    _giMap       = nullptr;
+    _accMap      = nullptr;
+    _dataMapSize = 0;
+    _gis         = nullptr;
+    _giCount     = 0;
+    _accs        = nullptr;
+    _accCount    = 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'scan' walks the mapped data file from 'offset' and adds every record to  */
+/* the pending (not yet indexed) entries. It returns where it stopped.       */
+/*                                                                           */
+/*****************************************************************************/
+
+qint64 RecordCache::scan( qint64 offset )
+{
+    GbRecord record;
+
+    while( offset + qint64( sizeof( quint32 ) ) <= _dataMapSize )
+    {
+        quint32 size;
+        std::memcpy( &size, _dataMap + offset, sizeof( quint32 ) );
+
+        const qint64 payload = offset + sizeof( quint32 );
+        if( payload + size > _dataMapSize ) break;
+
+        if( !deserialize( reinterpret_cast<const char *>( _dataMap + payload ),
+                          size, record ) ) break;
+
+        if( record.gi ) _pendingGi.insert( record.gi, offset );
+
+        QByteArray key = accessionKey( record.accession );
+        if( !key.isEmpty() ) _pendingAcc.insert( key, offset );
+
+        offset = payload + size;
+    }
+    return offset;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'readAt' reads the record stored at 'offset' of the data file             */
+/*                                                                           */
+/*****************************************************************************/
+
+bool RecordCache::readAt( quint64 offset, GbRecord &record )
+{
+    quint32 size;
+
+    // Records that were in the file when it was mapped are read in place
+
+    if( qint64( offset + sizeof( quint32 ) ) <= _dataMapSize )
+    {
+        std::memcpy( &size, _dataMap + offset, sizeof( quint32 ) );
+        if( qint64( offset + sizeof( quint32 ) + size ) <= _dataMapSize )
+        {
+            return deserialize( reinterpret_cast<const char *>(
+                                    _dataMap + offset + sizeof( quint32 ) ),
+                                size, record );
+        }
+    }
+
+    // Otherwise the record was appended later, read it from the file
+
+    if( !_dataFile.isOpen() && !_dataFile.open( QIODevice::ReadOnly ) )
+    {
+        return false;
+    }
+    if( !_dataFile.seek( offset ) ||
+        _dataFile.read( reinterpret_cast<char *>( &size ),
+                        sizeof( quint32 ) ) != sizeof( quint32 ) )
+    {
+        return false;
+    }
+
+    QByteArray payload = _dataFile.read( size );
+    return payload.size() == qsizetype( size ) &&
+           deserialize( payload.constData(), payload.size(), record );
+}
+
+qint64 RecordCache::findGi( quint64 gi )
+{
+    const GiEntry *end = _gis + _giCount;
+    const GiEntry *it  = std::lower_bound( _gis, end, gi,
+        []( const GiEntry &e, quint64 key ) { return e.gi < key; } );
+
+    if( it != end && it->gi == gi ) return it->offset;
+
+    auto pending = _pendingGi.constFind( gi );
+    if( pending != _pendingGi.constEnd() ) return pending.value();
+
+    return -1;
+}
+
+qint64 RecordCache::findAccessionKey( const QByteArray &key )
+{
+    const AccEntry *end = _accs + _accCount;
+    const AccEntry *it  = std::lower_bound( _accs, end, key,
+        []( const AccEntry &e, const QByteArray &k ) {
+            return std::memcmp( e.accession, k.constData(), accessionSize ) < 0;
+        } );
+
+    if( it != end &&
+        std::memcmp( it->accession, key.constData(), accessionSize ) == 0 )
+    {
+        return it->offset;
+    }
+
+    auto pending = _pendingAcc.constFind( key );
+    if( pending != _pendingAcc.constEnd() ) return pending.value();
+
+    return -1;
+}
+
+bool RecordCache::contains( ulong gi )
+{
+    return _journalGi.contains( gi ) || findGi( gi ) >= 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'find' looks up a record by GI, and 'findAccession' by accession.version. */
+/* Both return false if the record is not in the cache.                      */
+/*                                                                           */
+/*****************************************************************************/
+
+bool RecordCache::find( ulong gi, GbRecord &record )
+{
+    auto journal = _journalGi.constFind( gi );
+    if( journal != _journalGi.constEnd() )
+    {
+        const char *entry = _journal.constData() + journal.value();
+        quint32 size;
+        std::memcpy( &size, entry, sizeof( quint32 ) );
+        return deserialize( entry + sizeof( quint32 ), size, record );
+    }
+
+    qint64 offset = findGi( gi );
+    return offset >= 0 && readAt( offset, record );
+}
+
+bool RecordCache::findAccession( const QString &accession, GbRecord &record )
+{
+    QByteArray key = accessionKey( accession );
+    if( key.isEmpty() ) return false;
+
+    for( qsizetype i = 0; i < _journalAcc.size(); ++i )
+    {
+        if( _journalAcc.at( i ) == key )
+        {
+            const char *entry = _journal.constData() + _journalOffsets.at( i );
+            quint32 size;
+            std::memcpy( &size, entry, sizeof( quint32 ) );
+            return deserialize( entry + sizeof( quint32 ), size, record );
+        }
+    }
+
+    qint64 offset = findAccessionKey( key );
+    return offset >= 0 && readAt( offset, record );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'insert' adds a freshly fetched record to the memory journal              */
+/*                                                                           */
+/*****************************************************************************/
+
+void RecordCache::insert( const GbRecord &record )
+{
+    if( _error || contains( record.gi ) ) return;
+
+    QByteArray payload = serialize( record );
+    quint32    size    = payload.size();
+    qsizetype  offset  = _journal.size();
+
+    _journal.append( reinterpret_cast<const char *>( &size ), sizeof( quint32 ) );
+    _journal.append( payload );
+
+    if( record.gi ) _journalGi.insert( record.gi, offset );
+    _journalAcc.append( accessionKey( record.accession ) );
+    _journalOffsets.append( offset );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'wholeSize' follows the length prefixes of the data file from 'offset'    */
+/* (the end of a whole record) and returns the end of the last record that   */
+/* is all there. Only the prefixes are read.                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+qint64 RecordCache::wholeSize( QFile &data, qint64 offset )
+{
+    const qint64 size = data.size();
+
+    while( offset + qint64( sizeof( quint32 ) ) <= size )
+    {
+        quint32 length;
+
+        if( !data.seek( offset ) ||
+            data.read( reinterpret_cast<char *>( &length ), sizeof( quint32 ) ) !=
+                qint64( sizeof( quint32 ) ) ) break;
+
+        const qint64 end = offset + qint64( sizeof( quint32 ) ) + length;
+        if( end > size ) break;
+
+        offset = end;
+    }
+    return offset;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'commit' appends the journal to the data file, in a single write while    */
+/* holding the lock. The records become pending (not yet indexed) entries.   */
+/* If the data file changed size since we last wrote to it, another process  */
+/* appended to it and may have been killed doing so: the records it added    */
+/* are followed by their length prefixes, and a torn one at the end is cut   */
+/* off first, or every record appended after it would be lost to 'scan'.     */
+/*                                                                           */
+/*****************************************************************************/
+
+void RecordCache::commit()
+{
+    if( _error || _journal.isEmpty() ) return;
+
+    QLockFile lock( path( "lock" ) );
+    if( !lock.lock() )
+    {
+        qDebug() << "Cannot lock record cache" << _directory;
+        return;
+    }
+
+    QFile data( path( "records.dat" ) );
+    if( !data.open( QIODevice::ReadWrite ) )
+    {
+        qDebug() << "Cannot write record cache:" << data.errorString();
+        return;
+    }
+
+    qint64 valid = data.size();
+
+    if( valid != _seenSize )
+    {
+        valid = wholeSize( data, qMin( _validEnd, valid ) );
+    }
+
+    if( valid < data.size() )
+    {
+        qDebug() << "Dropping" << data.size() - valid
+                 << "bytes of a torn record from the record cache";
+        if( !data.resize( valid ) )
+        {
+            qDebug() << "Cannot repair record cache:" << data.errorString();
+            return;
+        }
+    }
+
+    const quint64 base = valid;
+
+    if( !data.seek( valid ) )
+    {
+        qDebug() << "Cannot write record cache:" << data.errorString();
+        return;
+    }
+
+    if( data.write( _journal ) != _journal.size() )
+    {
+        qDebug() << "Cannot write record cache:" << data.errorString();
+        return;
+    }
+    data.close();
+
+    _validEnd = base + _journal.size();
+    _seenSize = _validEnd;
+
+    for( auto it = _journalGi.cbegin(); it != _journalGi.cend(); ++it )
+    {
+        _pendingGi.insert( it.key(), base + it.value() );
+    }
+    for( qsizetype i = 0; i < _journalAcc.size(); ++i )
+    {
+        if( !_journalAcc.at( i ).isEmpty() )
+        {
+            _pendingAcc.insert( _journalAcc.at( i ), base + _journalOffsets.at( i ) );
+        }
+    }
+
+    _journal.clear();
+    _journalGi.clear();
+    _journalAcc.clear();
+    _journalOffsets.clear();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'sync' commits the journal and rewrites both indexes so that they cover   */
+/* the whole data file. Indexes written meanwhile by other processes are     */
+/* reloaded first, so that no entry is lost.                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+void RecordCache::sync()
+{
+    commit();
+
+    if( _error || ( _pendingGi.isEmpty() && _pendingAcc.isEmpty() ) ) return;
+
+    QLockFile lock( path( "lock" ) );
+    if( !lock.lock() )
+    {
+        qDebug() << "Cannot lock record cache" << _directory;
+        return;
+    }
+
+    // Map the latest indexes and data. Scanning the data file past what the
+    // indexes cover picks up our own pending records as well as records
+    // appended by other processes.
+
+    load();
+
+    if( writeIndexes( _covered ) )
+    {
+        _pendingGi.clear();
+        _pendingAcc.clear();
+        load();
+    }
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'writeIndexes' merges the mapped indexes with the pending entries and     */
+/* atomically replaces both index files.                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+bool RecordCache::writeIndexes( quint64 dataSize )
+{
+    IndexHeader header;
+    header.dataSize = dataSize;
+
+    QByteArray block;
+    block.reserve( 1 << 20 );
+
+    // GI index
+
+    QSaveFile gis( path( "gi.idx" ) );
+    if( !gis.open( QIODevice::WriteOnly ) ) return false;
+
+    std::memcpy( header.magic, giMagic, 8 );
+    gis.write( reinterpret_cast<const char *>( &header ), sizeof( IndexHeader ) );
+
+    qsizetype i  = 0;
+    auto      it = _pendingGi.cbegin();
+    while( i < _giCount || it != _pendingGi.cend() )
+    {
+        GiEntry e;
+        if( it == _pendingGi.cend() || ( i < _giCount && _gis[i].gi <= it.key() ) )
+        {
+            // Entries already indexed win over pending duplicates
+            e = _gis[i++];
+            if( it != _pendingGi.cend() && it.key() == e.gi ) ++it;
+        }
+        else
+        {
+            e = { it.key(), it.value() };
+            ++it;
+        }
+        block.append( reinterpret_cast<const char *>( &e ), sizeof( GiEntry ) );
+        if( block.size() >= ( 1 << 20 ) )
+        {
+            gis.write( block );
+            block.resize( 0 );
+        }
+    }
+    gis.write( block );
+    block.resize( 0 );
+
+    // Accession index
+
+    QSaveFile accs( path( "acc.idx" ) );
+    if( !accs.open( QIODevice::WriteOnly ) ) return false;
+
+    std::memcpy( header.magic, accMagic, 8 );
+    accs.write( reinterpret_cast<const char *>( &header ), sizeof( IndexHeader ) );
+
+    i = 0;
+    auto at = _pendingAcc.cbegin();
+    while( i < _accCount || at != _pendingAcc.cend() )
+    {
+        AccEntry e;
+        int cmp = at == _pendingAcc.cend() ? -1 :
+                  i >= _accCount ? 1 :
+                  std::memcmp( _accs[i].accession, at.key().constData(), accessionSize );
+        if( cmp <= 0 )
+        {
+            e = _accs[i++];
+            if( cmp == 0 ) ++at;
+        }
+        else
+        {
+            std::memcpy( e.accession, at.key().constData(), accessionSize );
+            e.offset = at.value();
+            ++at;
+        }
+        block.append( reinterpret_cast<const char *>( &e ), sizeof( AccEntry ) );
+        if( block.size() >= ( 1 << 20 ) )
+        {
+            accs.write( block );
+            block.resize( 0 );
+        }
+    }
+    accs.write( block );
+
+    // The accession index is committed last: a reader only trusts the data
+    // size recorded in both headers
+
+    return gis.commit() && accs.commit();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* Helpers: fixed size accession keys and record (de)serialization           */
+/*                                                                           */
+/*****************************************************************************/
+
+QByteArray RecordCache::accessionKey( const QString &accession )
+{
+    // Accessions that do not fit the fixed size key are only indexed by GI
+
+    if( accession.isEmpty() || accession.size() > accessionSize )
+    {
+        return QByteArray();
+    }
+
+    QByteArray key = accession.toLatin1();
+    key.append( QByteArray( accessionSize - key.size(), '\0' ) );
+    return key;
+}
+
+QByteArray RecordCache::serialize( const GbRecord &record )
+{
+    QByteArray  payload;
+    QDataStream out( &payload, QIODevice::WriteOnly );
+    out.setVersion( QDataStream::Qt_6_0 );
+
+    out << quint64( record.gi )
+        << record.accession
+        << record.organism
+        << record.country
+        << record.sequence;
+
+    // Sequences are stored as the parsers left them (normalized), together
+    // with their base counts
+
+    const BaseCounts &bases = record.bases;
+    out << bases.a << bases.c << bases.g << bases.t
+        << bases.ambiguous << bases.gaps << bases.invalid;
+
+    return payload;
+}
+
+bool RecordCache::deserialize( const char *data, qsizetype size, GbRecord &record )
+{
+    QByteArray  payload = QByteArray::fromRawData( data, size );
+    QDataStream in( payload );
+    in.setVersion( QDataStream::Qt_6_0 );
+
+    quint64 gi;
+    in >> gi
+       >> record.accession
+       >> record.organism
+       >> record.country
+       >> record.sequence;
+    record.gi = gi;
+
+    BaseCounts &bases = record.bases;
+    in >> bases.a >> bases.c >> bases.g >> bases.t
+       >> bases.ambiguous >> bases.gaps >> bases.invalid;
+
+    return in.status() == QDataStream::Ok;
+}
@@ -0,0 +1,97 @@
+#ifndef RECORDCACHE_H
+#define RECORDCACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+
+#include "gbrecord.h"
+
+class RecordCache
+{
+    // Layout of the index files. Both are a header followed by entries sorted
+    // by key, so that they can be searched in place once memory mapped.
+
+    struct IndexHeader
+    {
+        char            magic[8];
+        quint64         dataSize;
+    };
+
+    struct GiEntry
+    {
+        quint64         gi;
+        quint64         offset;
+    };
+
+    static constexpr int accessionSize = 24;
+
+    struct AccEntry
+    {
+        char            accession[accessionSize];
+        quint64         offset;
+    };
+
+    QString             _directory      {""};
+    bool                _error          {false};
+    QString             _errorMessage   {"No error in record cache"};
+
+    // Memory mapped snapshot of the data and index files
+
+    QFile               _dataFile;
+    QFile               _giFile;
+    QFile               _accFile;
+    uchar               *_dataMap       {nullptr};
+    uchar               *_giMap         {nullptr};
+    uchar               *_accMap        {nullptr};
+    qint64              _dataMapSize    {0};
+    qint64              _covered        {0};
+    qint64              _validEnd       {0};    // end of a record known to be whole
+    qint64              _seenSize       {0};    // size of the data file last seen
+    const GiEntry       *_gis           {nullptr};
+    qsizetype           _giCount        {0};
+    const AccEntry      *_accs          {nullptr};
+    qsizetype           _accCount       {0};
+
+    // Records written to the data file but not yet indexed
+
+    QMap<quint64, quint64>      _pendingGi;
+    QMap<QByteArray, quint64>   _pendingAcc;
+
+    // Records inserted but not yet written to the data file
+
+    QByteArray                  _journal;
+    QHash<quint64, qsizetype>   _journalGi;
+    QList<QByteArray>           _journalAcc;
+    QList<qsizetype>            _journalOffsets;
+
+    QString         path( const QString & );
+    void            load();
+    void            unload();
+    qint64          scan( qint64 );
+    qint64          wholeSize( QFile &, qint64 );
+    bool            readAt( quint64, GbRecord & );
+    qint64          findGi( quint64 );
+    qint64          findAccessionKey( const QByteArray & );
+    bool            writeIndexes( quint64 );
+
+    static QByteArray   accessionKey( const QString & );
+    static QByteArray   serialize( const GbRecord & );
+    static bool         deserialize( const char *, qsizetype, GbRecord & );
+
+public:
+    RecordCache( const QString & );
+    ~RecordCache();
+    bool            hasError();
+    QString         errorMessage();
+    bool            contains( ulong );
+    bool            find( ulong, GbRecord & );
+    bool            findAccession( const QString &, GbRecord & );
+    void            insert( const GbRecord & );
+    void            commit();
+    void            sync();
+};
+
+#endif // RECORDCACHE_H
@@ -0,0 +1,80 @@
+#include "recordparser.h"
+#include "efetch.h"
+#include "esummary.h"
+#include "fastaparser.h"
+
+RecordParser::~RecordParser()
+{
+}
+
+void RecordParser::setRecordHandler( RecordHandler handler )
+{
+    _handler = handler;
+}
+
+void RecordParser::setProjection( const Projection &projection )
+{
+    _projection = projection;
+}
+
+void RecordParser::emitRecord( const GbRecord &record )
+{
+    _records++;
+    if( _handler ) _handler( record );
+}
+
+bool RecordParser::hasError()
+{
+    return _error;
+}
+
+QString RecordParser::errorMessage()
+{
+    return _errorMessage;
+}
+
+ulong RecordParser::fetchedRecords()
+{
+    return _records;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'create' returns the dedicated parser of a fetch profile                  */
+/*                                                                           */
+/*****************************************************************************/
+
+RecordParser *RecordParser::create( FetchProfile profile )
+{
+    switch( profile )
+    {
+        case FetchProfile::Fasta:
+            return new FastaParser();
+        case FetchProfile::Summary:
+            return new Esummary();
+        case FetchProfile::GbXml:
+            break;
+    }
+    return new Efetch();
+}
+
+bool RecordParser::profileFromString( const QString &name, FetchProfile &profile )
+{
+    if( name == "gb-xml" )
+    {
+        profile = FetchProfile::GbXml;
+    }
+    else if( name == "fasta" )
+    {
+        profile = FetchProfile::Fasta;
+    }
+    else if( name == "summary" )
+    {
+        profile = FetchProfile::Summary;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
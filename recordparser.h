@@ -0,0 +1,59 @@
+#ifndef RECORDPARSER_H
+#define RECORDPARSER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <functional>
+
+#include "gbrecord.h"
+#include "projection.h"
+
+// The format requested from NCBI for every record. Full GenBank XML carries
+// the feature table, references and qualifiers; when only the accession and
+// the sequence are needed FASTA is several times smaller, and when only the
+// metadata is needed the document summary (from 'esummary') carries no
+// sequence at all.
+
+enum class FetchProfile
+{
+    GbXml,
+    Fasta,
+    Summary
+};
+
+// A 'RecordParser' is an incremental parser of the reply to a fetch request.
+// The reply is fed to it with 'addData()' as bytes arrive, and each complete
+// record is handed to the record handler right away. 'finish()' is called
+// once the whole reply has been fed. A 'Projection' tells which fields of the
+// records to extract.
+
+class RecordParser
+{
+public:
+    using RecordHandler = std::function<void( const GbRecord & )>;
+
+protected:
+    bool                _error          {false};
+    QString             _errorMessage   {"No error parsing source"};
+    ulong               _records        {0};
+    RecordHandler       _handler;
+    Projection          _projection;
+
+    void                emitRecord( const GbRecord & );
+
+public:
+    virtual ~RecordParser();
+    void            setRecordHandler( RecordHandler );
+    void            setProjection( const Projection & );
+    virtual void    addData( const QByteArray & ) = 0;
+    virtual void    finish() = 0;
+    bool            hasError();
+    QString         errorMessage();
+    ulong           fetchedRecords();
+
+    static RecordParser *   create( FetchProfile );
+    static bool             profileFromString( const QString &, FetchProfile & );
+};
+
+#endif // RECORDPARSER_H
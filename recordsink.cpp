@@ -0,0 +1,579 @@
+#include <QDebug>
+
+#include <cstdio>
+
+#include "recordsink.h"
+#include "sequencestore.h"
+
+// Records reach the sinks straight from the parser's record handler, one at a
+// time, and are never accumulated. The formatted text is appended to a memory
+// block which is written out whenever it grows past '_blockSize', so that
+// output costs a few large writes instead of one small write per record.
+//
+// Sinks created with 'Dedup' write every distinct sequence once, under its
+// content address (see 'sequencestore.cpp'), and every record refers to its
+// sequence by that address:
+//
+// - FASTA: one entry per distinct sequence, '>address accession organism'
+//   (from the first record that has it), plus a map file ('<output>.map')
+//   with the accession, GI and sequence address of every record.
+// - TSV: a 'sequence_id' column.
+// - JSONL: a "sequence_id" field; "sequence" only the first time.
+//
+// Only the addresses of the sequences written are kept in memory. A run
+// resumed from a checkpoint may write a sequence again, under the same
+// address.
+//
+// With 'Qc' the TSV and JSONL outputs also give the length, GC content and
+// number of ambiguous and invalid symbols of every sequence. The parsers count
+// them while reading the sequence (see 'nucleotides.cpp'), so they cost
+// nothing here.
+//
+// The extra qualifiers of a 'Projection' (see 'projection.cpp') follow the
+// country: one column each in TSV, one field each in JSONL. FASTA headers do
+// not carry them.
+
+namespace
+{
+
+// Append a QString as UTF-8 without a temporary QByteArray for the (usual)
+// ASCII case
+
+void appendText( QByteArray &buffer, const QString &text )
+{
+    for( const QChar c : text )
+    {
+        if( c.unicode() >= 0x80 )
+        {
+            buffer.append( text.toUtf8() );
+            return;
+        }
+    }
+    for( const QChar c : text )
+    {
+        buffer.append( c.toLatin1() );
+    }
+}
+
+// Replace characters that would break the TSV layout
+
+void appendTsvField( QByteArray &buffer, const QString &text )
+{
+    qsizetype start = buffer.size();
+    appendText( buffer, text );
+    for( qsizetype i = start; i < buffer.size(); ++i )
+    {
+        if( buffer[i] == '\t' || buffer[i] == '\n' || buffer[i] == '\r' )
+        {
+            buffer[i] = ' ';
+        }
+    }
+}
+
+// Append a single byte of a JSON string, escaping it as needed
+
+void appendJsonChar( QByteArray &buffer, const char c )
+{
+    static const char hex[] = "0123456789abcdef";
+
+    switch( c )
+    {
+        case '"':  buffer.append( "\\\"" ); break;
+        case '\\': buffer.append( "\\\\" ); break;
+        case '\n': buffer.append( "\\n" );  break;
+        case '\r': buffer.append( "\\r" );  break;
+        case '\t': buffer.append( "\\t" );  break;
+        default:
+            if( static_cast<unsigned char>( c ) < 0x20 )
+            {
+                buffer.append( "\\u00" );
+                buffer.append( hex[ ( c >> 4 ) & 0xf ] );
+                buffer.append( hex[ c & 0xf ] );
+            }
+            else
+            {
+                buffer.append( c );
+            }
+    }
+}
+
+// Append a JSON string literal (with quotes)
+
+void appendJsonString( QByteArray &buffer, const QString &text )
+{
+    bool ascii {true};
+
+    for( const QChar c : text )
+    {
+        if( c.unicode() >= 0x80 )
+        {
+            ascii = false;
+            break;
+        }
+    }
+
+    buffer.append( '"' );
+    if( ascii )
+    {
+        for( const QChar c : text ) appendJsonChar( buffer, c.toLatin1() );
+    }
+    else
+    {
+        const QByteArray utf8 = text.toUtf8();
+        for( const char c : utf8 ) appendJsonChar( buffer, c );
+    }
+    buffer.append( '"' );
+}
+
+// Append a JSON string literal of bytes (a sequence). Sequences are almost
+// always plain letters and go out whole; otherwise every byte is escaped as
+// needed, and those outside ASCII are taken as Latin-1 (a sequence is not
+// UTF-8), so that the line stays valid JSON whatever the parser let through.
+
+void appendJsonBytes( QByteArray &buffer, const QByteArray &bytes )
+{
+    bool plain {true};
+
+    for( const char c : bytes )
+    {
+        const unsigned char u = static_cast<unsigned char>( c );
+        if( u < 0x20 || u >= 0x80 || c == '"' || c == '\\' )
+        {
+            plain = false;
+            break;
+        }
+    }
+
+    buffer.append( '"' );
+    if( plain )
+    {
+        buffer.append( bytes );
+    }
+    else
+    {
+        for( const char c : bytes )
+        {
+            const unsigned char u = static_cast<unsigned char>( c );
+            if( u >= 0x80 )
+            {
+                buffer.append( char( 0xc0 | ( u >> 6 ) ) );
+                buffer.append( char( 0x80 | ( u & 0x3f ) ) );
+            }
+            else
+            {
+                appendJsonChar( buffer, c );
+            }
+        }
+    }
+    buffer.append( '"' );
+}
+
+}
+
+RecordSink::~RecordSink()
+{
+}
+
+void RecordSink::flush()
+{
+}
+
+// Bytes written out so far, or -1 if the sink does not write to a file
+
+qint64 RecordSink::size()
+{
+    return -1;
+}
+
+// A summary of what the sink did (such as its deduplication), if anything
+
+QString RecordSink::statistics()
+{
+    return QString();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'create' builds a sink for a given format ("fasta", "tsv" or "jsonl")     */
+/* writing to 'fileName' (the standard output if empty or "-"). It returns   */
+/* a null pointer if the format is unknown. A run resumed from a checkpoint  */
+/* passes the size of the output when the checkpoint was last written as     */
+/* 'resumeAt': the file is cut back to that size and appended to. 'options'  */
+/* is a combination of 'Option' flags, and 'qualifiers' the names of the     */
+/* extra qualifiers of the records.                                          */
+/*                                                                           */
+/*****************************************************************************/
+
+RecordSink *RecordSink::create( const QString &format,
+                                const QString &fileName,
+                                qint64 resumeAt,
+                                int options,
+                                const QStringList &qualifiers )
+{
+    if( format == "fasta" ) return new FastaSink( fileName, resumeAt, options, qualifiers );
+    if( format == "tsv" )   return new TsvSink( fileName, resumeAt, options, qualifiers );
+    if( format == "jsonl" ) return new JsonlSink( fileName, resumeAt, options, qualifiers );
+    return nullptr;
+}
+
+BufferedSink::BufferedSink( const QString &fileName, qint64 resumeAt, int options,
+                            const QStringList &qualifiers )
+    : _options( options ), _qualifiers( qualifiers )
+{
+    bool opened {false};
+
+    if( fileName == "" || fileName == "-" )
+    {
+        opened = _file.open( stdout, QIODevice::WriteOnly );
+    }
+    else if( resumeAt >= 0 )
+    {
+        _file.setFileName( fileName );
+        opened = _file.open( QIODevice::ReadWrite );
+
+        if( opened && _file.size() < resumeAt )
+        {
+            _file.close();
+            _file.setErrorString( "output is shorter than recorded in the checkpoint" );
+            opened = false;
+        }
+        else if( opened )
+        {
+            _file.resize( resumeAt );
+            _file.seek( resumeAt );
+            _written = resumeAt;
+        }
+    }
+    else
+    {
+        _file.setFileName( fileName );
+        opened = _file.open( QIODevice::WriteOnly | QIODevice::Truncate );
+    }
+
+    if( !opened )
+    {
+        _errorMessage = "Cannot open output: " + _file.errorString();
+        _error = true;
+        qDebug() << _errorMessage;
+    }
+
+    _buffer.reserve( _blockSize + ( _blockSize >> 2 ) );
+}
+
+BufferedSink::~BufferedSink()
+{
+    flush();
+}
+
+QByteArray &BufferedSink::buffer()
+{
+    return _buffer;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'commit' writes the memory block out once it is large enough              */
+/*                                                                           */
+/*****************************************************************************/
+
+void BufferedSink::commit()
+{
+    if( _buffer.size() >= _blockSize ) flush();
+}
+
+void BufferedSink::flush()
+{
+    if( !_error && !_buffer.isEmpty() )
+    {
+        if( _file.write( _buffer ) == _buffer.size() )
+        {
+            _written += _buffer.size();
+        }
+        else
+        {
+            _errorMessage = "Error writing output: " + _file.errorString();
+            _error = true;
+            qDebug() << _errorMessage;
+        }
+        _file.flush();
+    }
+    _buffer.resize( 0 );
+}
+
+qint64 BufferedSink::size()
+{
+    return _written;
+}
+
+bool BufferedSink::hasError()
+{
+    return _error;
+}
+
+QString BufferedSink::errorMessage()
+{
+    return _errorMessage;
+}
+
+bool BufferedSink::deduplicating()
+{
+    return _options & Dedup;
+}
+
+bool BufferedSink::qc()
+{
+    return _options & Qc;
+}
+
+const QStringList &BufferedSink::qualifiers()
+{
+    return _qualifiers;
+}
+
+// 'firstSeen' tells whether a sequence (of 'bytes' bases) is written for the
+// first time, and accounts for it
+
+bool BufferedSink::firstSeen( quint64 id, qsizetype bytes )
+{
+    _records++;
+    _bytes += bytes;
+
+    if( _emitted.contains( id ) ) return false;
+
+    _emitted.insert( id );
+    _uniqueBytes += bytes;
+    return true;
+}
+
+QString BufferedSink::statistics()
+{
+    if( !deduplicating() || _records == 0 ) return QString();
+
+    return QString( "%1 records, %2 distinct sequences, %3 of %4 sequence bytes written (%5%)" )
+           .arg( _records ).arg( _emitted.size() )
+           .arg( _uniqueBytes ).arg( _bytes )
+           .arg( _bytes > 0 ? 100.0 * _uniqueBytes / _bytes : 100.0, 0, 'f', 1 );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* FASTA: a '>accession organism' header followed by the sequence in lines   */
+/* of '_lineWidth' bases                                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+FastaSink::FastaSink( const QString &fileName, qint64 resumeAt, int options,
+                       const QStringList &qualifiers )
+    : BufferedSink( fileName, resumeAt, options, qualifiers )
+{
+    if( !deduplicating() ) return;
+
+    _map.setFileName( fileName + ".map" );
+    if( _map.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        _mapBuffer.append( "accession\tgi\tsequence_id\n" );
+    }
+    else
+    {
+        qDebug() << "Cannot open sequence map:" << _map.errorString();
+    }
+}
+
+FastaSink::~FastaSink()
+{
+    flush();
+}
+
+void FastaSink::flush()
+{
+    BufferedSink::flush();
+
+    if( _map.isOpen() && !_mapBuffer.isEmpty() )
+    {
+        _map.write( _mapBuffer );
+        _map.flush();
+    }
+    _mapBuffer.resize( 0 );
+}
+
+void FastaSink::write( const GbRecord &record )
+{
+    QByteArray &out = buffer();
+
+    if( deduplicating() )
+    {
+        const quint64    id      = SequenceStore::hash( record.sequence );
+        const QByteArray address = SequenceStore::idString( id );
+
+        appendTsvField( _mapBuffer, record.accession );
+        _mapBuffer.append( '\t' );
+        _mapBuffer.append( QByteArray::number( qulonglong( record.gi ) ) );
+        _mapBuffer.append( '\t' );
+        _mapBuffer.append( address );
+        _mapBuffer.append( '\n' );
+
+        if( _mapBuffer.size() >= ( 1 << 20 ) ) flush();
+
+        if( !firstSeen( id, record.sequence.size() ) ) return;
+
+        out.append( '>' );
+        out.append( address );
+        out.append( ' ' );
+    }
+    else
+    {
+        out.append( '>' );
+    }
+    appendText( out, record.accession );
+    if( record.organism != "" )
+    {
+        out.append( ' ' );
+        appendText( out, record.organism );
+    }
+    out.append( '\n' );
+
+    for( qsizetype i = 0; i < record.sequence.size(); i += _lineWidth )
+    {
+        out.append( record.sequence.constData() + i,
+                    qMin<qsizetype>( _lineWidth, record.sequence.size() - i ) );
+        out.append( '\n' );
+    }
+
+    commit();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* TSV: one line per record with accession, GI and qualifiers                */
+/*                                                                           */
+/*****************************************************************************/
+
+TsvSink::TsvSink( const QString &fileName, qint64 resumeAt, int options,
+                   const QStringList &qualifiers )
+    : BufferedSink( fileName, resumeAt, options, qualifiers )
+{
+    // A resumed output already has its header
+
+    if( size() == 0 )
+    {
+        QByteArray &out = buffer();
+
+        out.append( "accession\tgi\torganism\tcountry" );
+        for( const QString &name : qualifiers() )
+        {
+            out.append( '\t' );
+            appendTsvField( out, name );
+        }
+        if( deduplicating() ) out.append( "\tsequence_id" );
+        if( qc() ) out.append( "\tlength\tgc\tambiguous\tinvalid" );
+        out.append( '\n' );
+    }
+}
+
+void TsvSink::write( const GbRecord &record )
+{
+    QByteArray &out = buffer();
+
+    appendTsvField( out, record.accession );
+    out.append( '\t' );
+    out.append( QByteArray::number( qulonglong( record.gi ) ) );
+    out.append( '\t' );
+    appendTsvField( out, record.organism );
+    out.append( '\t' );
+    appendTsvField( out, record.country );
+    for( qsizetype i = 0; i < qualifiers().size(); ++i )
+    {
+        out.append( '\t' );
+        if( i < record.qualifiers.size() ) appendTsvField( out, record.qualifiers.at( i ) );
+    }
+    if( deduplicating() )
+    {
+        const quint64 id = SequenceStore::hash( record.sequence );
+        firstSeen( id, record.sequence.size() );
+        out.append( '\t' );
+        out.append( SequenceStore::idString( id ) );
+    }
+    if( qc() )
+    {
+        const BaseCounts &bases = record.bases;
+
+        out.append( '\t' );
+        out.append( QByteArray::number( bases.length() ) );
+        out.append( '\t' );
+        out.append( QByteArray::number( bases.gc(), 'f', 4 ) );
+        out.append( '\t' );
+        out.append( QByteArray::number( bases.ambiguous ) );
+        out.append( '\t' );
+        out.append( QByteArray::number( bases.invalid ) );
+    }
+    out.append( '\n' );
+
+    commit();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* JSONL: one JSON object per line                                           */
+/*                                                                           */
+/*****************************************************************************/
+
+JsonlSink::JsonlSink( const QString &fileName, qint64 resumeAt, int options,
+                       const QStringList &qualifiers )
+    : BufferedSink( fileName, resumeAt, options, qualifiers )
+{
+}
+
+void JsonlSink::write( const GbRecord &record )
+{
+    QByteArray &out = buffer();
+
+    out.append( "{\"accession\":" );
+    appendJsonString( out, record.accession );
+    out.append( ",\"gi\":" );
+    out.append( QByteArray::number( qulonglong( record.gi ) ) );
+    out.append( ",\"organism\":" );
+    appendJsonString( out, record.organism );
+    out.append( ",\"country\":" );
+    appendJsonString( out, record.country );
+    for( qsizetype i = 0; i < qualifiers().size(); ++i )
+    {
+        out.append( ',' );
+        appendJsonString( out, qualifiers().at( i ) );
+        out.append( ':' );
+        appendJsonString( out, i < record.qualifiers.size() ? record.qualifiers.at( i )
+                                                            : QString() );
+    }
+    if( qc() )
+    {
+        const BaseCounts &bases = record.bases;
+
+        out.append( ",\"length\":" );
+        out.append( QByteArray::number( bases.length() ) );
+        out.append( ",\"gc\":" );
+        out.append( QByteArray::number( bases.gc(), 'f', 4 ) );
+        out.append( ",\"ambiguous\":" );
+        out.append( QByteArray::number( bases.ambiguous ) );
+        out.append( ",\"invalid\":" );
+        out.append( QByteArray::number( bases.invalid ) );
+    }
+    if( deduplicating() )
+    {
+        const quint64 id = SequenceStore::hash( record.sequence );
+
+        out.append( ",\"sequence_id\":\"" );
+        out.append( SequenceStore::idString( id ) );
+        out.append( '"' );
+
+        if( !firstSeen( id, record.sequence.size() ) )
+        {
+            out.append( "}\n" );
+            commit();
+            return;
+        }
+    }
+    out.append( ",\"sequence\":" );
+    appendJsonBytes( out, record.sequence );
+    out.append( "}\n" );
+
+    commit();
+}
@@ -0,0 +1,106 @@
+#ifndef RECORDSINK_H
+#define RECORDSINK_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QFile>
+#include <QSet>
+
+#include "gbrecord.h"
+
+// A 'RecordSink' receives every record as soon as it is parsed. Sinks write
+// records out (or hand them elsewhere) without keeping them in memory.
+
+class RecordSink
+{
+public:
+    enum Option
+    {
+        Dedup   = 0x1,      // every distinct sequence once
+        Qc      = 0x2       // length, GC content and ambiguity of every record
+    };
+
+    virtual ~RecordSink();
+    virtual void    write( const GbRecord & ) = 0;
+    virtual void    flush();
+    virtual qint64  size();
+    virtual QString statistics();
+
+    static RecordSink * create( const QString &, const QString &,
+                                qint64 resumeAt = -1, int options = 0,
+                                const QStringList &qualifiers = QStringList() );
+};
+
+// 'BufferedSink' collects formatted records in a memory block and writes it to
+// a file (or the standard output) in large chunks.
+
+class BufferedSink : public RecordSink
+{
+    QFile               _file;
+    QByteArray          _buffer;
+    qsizetype           _blockSize      {1 << 20};
+    qint64              _written        {0};
+    bool                _error          {false};
+    QString             _errorMessage   {"No error writing records"};
+
+    int                 _options        {0};
+    QStringList         _qualifiers;
+
+    // Content addresses of the sequences written so far, when deduplicating
+
+    QSet<quint64>       _emitted;
+    qint64              _records        {0};
+    qint64              _bytes          {0};
+    qint64              _uniqueBytes    {0};
+
+protected:
+    QByteArray &    buffer();
+    void            commit();
+    bool            deduplicating();
+    bool            qc();
+    const QStringList & qualifiers();
+    bool            firstSeen( quint64, qsizetype );
+
+public:
+    BufferedSink( const QString &, qint64, int, const QStringList & );
+    ~BufferedSink() override;
+    void            flush() override;
+    qint64          size() override;
+    QString         statistics() override;
+    bool            hasError();
+    QString         errorMessage();
+};
+
+class FastaSink : public BufferedSink
+{
+    int                 _lineWidth      {70};
+
+    // When deduplicating, which sequence every record has goes to a separate
+    // map file
+
+    QFile               _map;
+    QByteArray          _mapBuffer;
+
+public:
+    FastaSink( const QString &, qint64, int, const QStringList & );
+    ~FastaSink() override;
+    void            write( const GbRecord & ) override;
+    void            flush() override;
+};
+
+class TsvSink : public BufferedSink
+{
+public:
+    TsvSink( const QString &, qint64, int, const QStringList & );
+    void            write( const GbRecord & ) override;
+};
+
+class JsonlSink : public BufferedSink
+{
+public:
+    JsonlSink( const QString &, qint64, int, const QStringList & );
+    void            write( const GbRecord & ) override;
+};
+
+#endif // RECORDSINK_H
@@ -0,0 +1,198 @@
+#include <QEventLoop>
+#include <QTimer>
+
+#include "recordstream.h"
+#include "gbquery.h"
+
+// A 'RecordStream' runs a GbQuery for a program that embeds it, and hands the
+// records over as they are parsed, without any output file in between. The
+// query is configured through 'query()' (search terms, profile, projection,
+// cache...) before 'start'. Records are then either
+//
+// - pushed to a callback, set with 'setCallback', on the thread of the
+//   stream, or
+// - buffered, and pulled with 'next'. 'readyRead' is emitted when a record
+//   arrives in an empty buffer, and 'waitForReadyRead' blocks (running a local event
+//   loop) until then, so that a worker thread owning the stream can simply
+//   loop over it:
+//
+//   RecordStream stream;
+//   stream.query()->setQueryParams( "Corophium", "COI", key, 500 );
+//   stream.start();
+//
+//   GbRecord r;
+//   while( stream.waitForReadyRead() )
+//   {
+//       while( stream.next( r ) ) ingest( r );
+//   }
+//
+// The buffer is bounded: once it holds '_capacity' records the query stops
+// submitting fetches, and it starts again when the buffer is half empty.
+// Fetches already in flight still complete, so the buffer may exceed its
+// capacity by the records of the fetch window.
+//
+// 'cancel' aborts the query; 'finished' is emitted once the requests in
+// flight have wound down, and the stream may be deleted from then on.
+
+RecordStream::RecordStream( QObject *parent )
+    : QObject( parent )
+{
+    _query = new GbQuery( this );
+    connectQuery();
+}
+
+// Several streams may share a scheduler, and thus NCBI's rate limit
+
+RecordStream::RecordStream( Scheduler *scheduler, QObject *parent )
+    : QObject( parent )
+{
+    _query = new GbQuery( scheduler, this );
+    connectQuery();
+}
+
+RecordStream::~RecordStream()
+{
+}
+
+void RecordStream::connectQuery()
+{
+    connect( _query, &GbQuery::record,
+             this,   &RecordStream::received );
+    connect( _query, &GbQuery::quit,
+             this,   &RecordStream::queryFinished, Qt::QueuedConnection );
+    connect( _query, &GbQuery::search,
+             _query, &GbQuery::searchNCBI );
+}
+
+// The query, to be configured before 'start'. It is owned by the stream.
+
+GbQuery *RecordStream::query()
+{
+    return _query;
+}
+
+// Push records to 'callback' instead of buffering them. It must be set before
+// 'start'.
+
+void RecordStream::setCallback( Callback callback )
+{
+    _callback = callback;
+}
+
+void RecordStream::setCapacity( qsizetype records )
+{
+    _capacity = qMax<qsizetype>( 1, records );
+}
+
+// Run the search set up with 'GbQuery::setQueryParams', or fetch a list of
+// GIs
+
+void RecordStream::start()
+{
+    emit _query->search( 0 );
+}
+
+void RecordStream::start( const QList<ulong> &ids )
+{
+    _query->fetchIds( ids );
+}
+
+void RecordStream::cancel()
+{
+    _buffer.clear();
+    _query->cancel();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'next' takes the oldest record of the buffer. It returns false if there   */
+/* is none (yet, or at all once 'atEnd').                                    */
+/*                                                                           */
+/*****************************************************************************/
+
+bool RecordStream::next( GbRecord &record )
+{
+    if( _buffer.isEmpty() ) return false;
+
+    record = _buffer.dequeue();
+
+    if( _query->isPaused() && _buffer.size() <= _capacity / 2 )
+    {
+        _query->setPaused( false );
+    }
+    return true;
+}
+
+qsizetype RecordStream::available()
+{
+    return _buffer.size();
+}
+
+// Wait until a record is available or the query is over, at most 'msecs'
+// milliseconds (forever if negative). It returns true if a record is
+// available.
+
+bool RecordStream::waitForReadyRead( int msecs )
+{
+    if( !_buffer.isEmpty() ) return true;
+    if( _finished || msecs == 0 ) return false;
+
+    QEventLoop loop;
+    QTimer     timer;
+
+    connect( this,   &RecordStream::readyRead, &loop, &QEventLoop::quit );
+    connect( this,   &RecordStream::finished,  &loop, &QEventLoop::quit );
+    connect( &timer, &QTimer::timeout,         &loop, &QEventLoop::quit );
+
+    if( msecs > 0 )
+    {
+        timer.setSingleShot( true );
+        timer.start( msecs );
+    }
+    loop.exec();
+
+    return !_buffer.isEmpty();
+}
+
+// The query is over and every record has been taken
+
+bool RecordStream::atEnd()
+{
+    return _finished && _buffer.isEmpty();
+}
+
+bool RecordStream::isFinished()
+{
+    return _finished;
+}
+
+bool RecordStream::hasFailed()
+{
+    return _query->hasFailed();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'received' is a SLOT linked to the 'record' SIGNAL of the query           */
+/*                                                                           */
+/*****************************************************************************/
+
+void RecordStream::received( const GbRecord &record )
+{
+    if( _callback )
+    {
+        _callback( record );
+        return;
+    }
+
+    _buffer.enqueue( record );
+
+    if( _buffer.size() >= _capacity ) _query->setPaused( true );
+    if( _buffer.size() == 1 ) emit readyRead();
+}
+
+void RecordStream::queryFinished()
+{
+    _finished = true;
+    emit finished();
+}
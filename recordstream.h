@@ -0,0 +1,56 @@
+#ifndef RECORDSTREAM_H
+#define RECORDSTREAM_H
+
+#include <QObject>
+#include <QQueue>
+#include <QList>
+
+#include <functional>
+
+#include "gbrecord.h"
+
+class GbQuery;
+class Scheduler;
+
+class RecordStream : public QObject
+{
+    Q_OBJECT
+
+public:
+    using Callback = std::function<void( const GbRecord & )>;
+
+    explicit        RecordStream( QObject * parent = nullptr );
+    explicit        RecordStream( Scheduler *, QObject * parent = nullptr );
+    ~RecordStream();
+    GbQuery *       query();
+    void            setCallback( Callback );
+    void            setCapacity( qsizetype );
+    void            start();
+    void            start( const QList<ulong> & );
+    void            cancel();
+    bool            next( GbRecord & );
+    qsizetype       available();
+    bool            waitForReadyRead( int msecs = -1 );
+    bool            atEnd();
+    bool            isFinished();
+    bool            hasFailed();
+
+signals:
+    void            readyRead();
+    void            finished();
+
+private:
+    GbQuery         *_query;
+    Callback        _callback;
+    QQueue<GbRecord> _buffer;
+    qsizetype       _capacity       {1000};
+    bool            _finished       {false};
+
+    void            connectQuery();
+
+private slots:
+    void            received( const GbRecord & );
+    void            queryFinished();
+};
+
+#endif // RECORDSTREAM_H
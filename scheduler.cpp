@@ -0,0 +1,194 @@
+#include <QNetworkReply>
+#if QT_CONFIG(ssl)
+#include <QSslConfiguration>
+#endif
+#include <QDebug>
+
+#include <cmath>
+
+#include "scheduler.h"
+
+// NCBI limits the number of requests a client may submit to its eutils: 3
+// requests per second without an API Key and 10 requests per second with one.
+// Sleeping between requests would freeze the event loop (including replies
+// still downloading) and would waste most of that quota. Instead, every
+// request goes through a 'Scheduler', which implements a token bucket: tokens
+// accumulate at '_rate' tokens per second up to '_burst' tokens, and each
+// request submitted consumes one token. Requests that cannot be submitted yet
+// wait in '_queue' and a single shot QTimer wakes the scheduler when the next
+// token becomes available. At most '_maxInFlight' requests may be waiting for
+// a reply at the same time.
+//
+// The caller gets hold of the QNetworkReply through a 'StartHandler' which is
+// called when the request is actually submitted, usually to connect the
+// reply's 'finished' SIGNAL to the respective processing SLOT. Every request
+// belongs to a context object (its caller): the requests of a context that
+// is destroyed, or that calls 'cancel', are dropped from the queue, so that
+// no handler runs on behalf of an object that is gone.
+//
+// _scheduler->enqueue( this, request, [this]( QNetworkReply *reply ) {
+//     connect( reply, &QNetworkReply::finished,
+//              this,  &GbQuery::processESearch );
+// } );
+
+Scheduler::Scheduler( QObject *parent )
+    : QObject( parent )
+{
+    _manager = new QNetworkAccessManager( this );
+
+    _timer.setSingleShot( true );
+    connect( &_timer, &QTimer::timeout,
+             this,    &Scheduler::dispatch );
+
+    _clock.start();
+}
+
+Scheduler::~Scheduler()
+{
+}
+
+void Scheduler::setRate( double requestsPerSecond )
+{
+    refill();
+    _rate = requestsPerSecond > 0 ? requestsPerSecond : 1.0;
+}
+
+void Scheduler::setMaxInFlight( int requests )
+{
+    _maxInFlight = requests > 0 ? requests : 1;
+    dispatch();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'prewarm' resolves a host and opens a connection to it (with its TLS      */
+/* handshake for HTTPS) ahead of the first request, which then finds it in   */
+/* the connection pool of the manager. It consumes no token, since no        */
+/* request is sent. HTTP/2 must be allowed for the connection to be shared   */
+/* by requests that allow it, as ours do. Each host is warmed once.          */
+/*                                                                           */
+/*****************************************************************************/
+
+void Scheduler::prewarm( const QString &scheme, const QString &host, int port )
+{
+    const QString key = scheme + "://" + host + ":" + QString::number( port );
+
+    if( host.isEmpty() || _warm.contains( key ) ) return;
+    _warm.insert( key );
+
+#if QT_CONFIG(ssl)
+    if( scheme == "https" )
+    {
+        QSslConfiguration ssl = QSslConfiguration::defaultConfiguration();
+        ssl.setAllowedNextProtocols( { QSslConfiguration::ALPNProtocolHTTP2,
+                                       QSslConfiguration::NextProtocolHttp1_1 } );
+
+        _manager->connectToHostEncrypted( host, port < 0 ? 443 : port, ssl );
+        return;
+    }
+#endif
+    if( scheme == "http" )
+    {
+        _manager->connectToHost( host, port < 0 ? 80 : port );
+    }
+}
+
+void Scheduler::enqueue( QObject *context,
+                         const QNetworkRequest &request,
+                         StartHandler started )
+{
+    _queue.enqueue( { context, request, QByteArray(), false, started } );
+    dispatch();
+}
+
+// Requests with a body (such as 'epost' uploads) are submitted with POST
+
+void Scheduler::enqueue( QObject *context,
+                         const QNetworkRequest &request,
+                         const QByteArray &body,
+                         StartHandler started )
+{
+    _queue.enqueue( { context, request, body, true, started } );
+    dispatch();
+}
+
+// Drop the requests of 'context' that are still waiting in the queue
+
+void Scheduler::cancel( QObject *context )
+{
+    _queue.removeIf( [context]( const Job &job ) {
+        return job.context.isNull() || job.context == context;
+    } );
+}
+
+int Scheduler::inFlight()
+{
+    return _inFlight;
+}
+
+int Scheduler::queued()
+{
+    return _queue.size();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'refill' adds the tokens accumulated since the last refill to the bucket  */
+/*                                                                           */
+/*****************************************************************************/
+
+void Scheduler::refill()
+{
+    qint64 now = _clock.elapsed();
+
+    _tokens     = qMin( _burst, _tokens + ( now - _lastRefill ) * _rate / 1000.0 );
+    _lastRefill = now;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'dispatch' submits as many queued requests as tokens and the in-flight    */
+/* limit allow. If requests are left waiting for a token, the timer is armed */
+/* to fire when the next token becomes available.                            */
+/*                                                                           */
+/*****************************************************************************/
+
+void Scheduler::dispatch()
+{
+    refill();
+
+    while( !_queue.isEmpty() && _inFlight < _maxInFlight && _tokens >= 1.0 )
+    {
+        Job job = _queue.dequeue();
+
+        // The context of the request was destroyed meanwhile
+
+        if( job.context.isNull() ) continue;
+
+        _tokens -= 1.0;
+
+        QNetworkReply *reply = job.post ? _manager->post( job.request, job.body )
+                                        : _manager->get( job.request );
+        _inFlight++;
+
+        connect( reply, &QNetworkReply::finished,
+                 this,  &Scheduler::requestFinished );
+
+        job.started( reply );
+    }
+
+    // If we ran out of tokens (and not out of in-flight slots) wait for the
+    // next one. Otherwise 'requestFinished' will call us again.
+
+    if( !_queue.isEmpty() && _inFlight < _maxInFlight && !_timer.isActive() )
+    {
+        int wait = std::ceil( ( 1.0 - _tokens ) * 1000.0 / _rate );
+        _timer.start( qMax( wait, 1 ) );
+    }
+}
+
+void Scheduler::requestFinished()
+{
+    _inFlight--;
+    dispatch();
+}
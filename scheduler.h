@@ -0,0 +1,66 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+#include <QSet>
+#include <QTimer>
+
+#include <functional>
+
+class QNetworkReply;
+
+class Scheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    using StartHandler = std::function<void( QNetworkReply * )>;
+
+    explicit        Scheduler( QObject * parent = nullptr );
+    ~Scheduler();
+    void            setRate( double );
+    void            setMaxInFlight( int );
+    void            prewarm( const QString &, const QString &, int port = -1 );
+    void            enqueue( QObject *, const QNetworkRequest &, StartHandler );
+    void            enqueue( QObject *, const QNetworkRequest &, const QByteArray &,
+                             StartHandler );
+    void            cancel( QObject * );
+    int             inFlight();
+    int             queued();
+
+private:
+    struct Job
+    {
+        QPointer<QObject> context;
+        QNetworkRequest request;
+        QByteArray      body;
+        bool            post;
+        StartHandler    started;
+    };
+
+    QNetworkAccessManager           *_manager;
+
+    QQueue<Job>     _queue;
+    QSet<QString>   _warm;
+    QTimer          _timer;
+    QElapsedTimer   _clock;
+    double          _rate           {3.0};
+    double          _burst          {1.0};
+    double          _tokens         {1.0};
+    qint64          _lastRefill     {0};
+    int             _maxInFlight    {4};
+    int             _inFlight       {0};
+
+    void            refill();
+
+private slots:
+    void            dispatch();
+    void            requestFinished();
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,309 @@
+#include <QtEndian>
+#include <QDebug>
+
+#include <cstring>
+
+#include "sequencestore.h"
+
+// A 'SequenceStore' keeps every distinct sequence once. Barcode pulls (COI of
+// a popular taxon, say) contain thousands of records with the very same
+// haplotype; records refer to their sequence by index instead of carrying a
+// copy of it.
+//
+// Sequences are content addressed: the address of a sequence is a 64 bit
+// hash of its bases, folded to upper case (the parsers fold them already, but
+// sequences may come from elsewhere). The same sequence gets the same address
+// in every query and every run, which is what the deduplicated outputs rely
+// on (see 'recordsink.cpp'). The store itself checks the bases of sequences
+// with the same address, so a (most unlikely) collision never merges two
+// sequences; it is only counted.
+//
+// 'hash' reads eight bases at a time: each 64 bit word is folded to upper
+// case with a few bitwise operations (no per byte branch or table) and four
+// independent lanes absorb consecutive words, so that the multiplications
+// overlap in the pipeline. It runs at several GB/s, well beyond the parsers.
+//
+// With 'setPacked' the distinct sequences are kept in 2 bits per base (see
+// 'nucleotides.cpp'), a quarter of the memory, and unpacked on access.
+
+namespace
+{
+
+const quint64 prime1 {0x9e3779b185ebca87ull};
+const quint64 prime2 {0xc2b2ae3d27d4eb4full};
+
+// Fold the lower case ASCII letters of a word to upper case. A byte is a
+// lower case letter if it is at least 'a', at most 'z', and below 0x80.
+
+inline quint64 fold( quint64 w )
+{
+    const quint64 t = w & 0x7f7f7f7f7f7f7f7full;
+    const quint64 a = t + 0x1f1f1f1f1f1f1f1full;      // high bit if >= 'a'
+    const quint64 z = t + 0x0505050505050505ull;      // high bit if >  'z'
+
+    return w ^ ( ( a & ~z & ~w & 0x8080808080808080ull ) >> 2 );
+}
+
+inline quint64 load( const char *p )
+{
+    return fold( qFromLittleEndian<quint64>( p ) );
+}
+
+inline quint64 mix( quint64 lane, quint64 w )
+{
+    lane += w * prime2;
+    lane  = ( lane << 31 ) | ( lane >> 33 );
+    return lane * prime1;
+}
+
+inline quint64 finalize( quint64 h )
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Compare two sequences regardless of case
+
+bool sameBases( QByteArrayView a, QByteArrayView b )
+{
+    if( a.size() != b.size() ) return false;
+
+    const char *p = a.data();
+    const char *q = b.data();
+    qsizetype   n = a.size();
+    qsizetype   i = 0;
+
+    for( ; i + 8 <= n; i += 8 )
+    {
+        if( load( p + i ) != load( q + i ) ) return false;
+    }
+    for( ; i < n; ++i )
+    {
+        char c = p[i], d = q[i];
+        if( c >= 'a' && c <= 'z' ) c -= 'a' - 'A';
+        if( d >= 'a' && d <= 'z' ) d -= 'a' - 'A';
+        if( c != d ) return false;
+    }
+    return true;
+}
+
+}
+
+SequenceStore::SequenceStore()
+{
+}
+
+SequenceStore::~SequenceStore()
+{
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'hash' returns the content address of a sequence                          */
+/*                                                                           */
+/*****************************************************************************/
+
+quint64 SequenceStore::hash( QByteArrayView sequence )
+{
+    const char *p = sequence.data();
+    qsizetype   n = sequence.size();
+    qsizetype   i = 0;
+
+    quint64 h = prime1 * quint64( n );
+
+    if( n >= 32 )
+    {
+        quint64 v1 = prime1 + prime2;
+        quint64 v2 = prime2;
+        quint64 v3 = 0;
+        quint64 v4 = 0 - prime1;
+
+        for( ; i + 32 <= n; i += 32 )
+        {
+            v1 = mix( v1, load( p + i ) );
+            v2 = mix( v2, load( p + i + 8 ) );
+            v3 = mix( v3, load( p + i + 16 ) );
+            v4 = mix( v4, load( p + i + 24 ) );
+        }
+        h ^= mix( 0, v1 ) ^ mix( 1, v2 ) ^ mix( 2, v3 ) ^ mix( 3, v4 );
+    }
+
+    for( ; i + 8 <= n; i += 8 )
+    {
+        h = mix( h, load( p + i ) );
+    }
+
+    if( i < n )
+    {
+        char tail[8] {0, 0, 0, 0, 0, 0, 0, 0};
+        std::memcpy( tail, p + i, n - i );
+        h = mix( h, load( tail ) );
+    }
+
+    return finalize( h );
+}
+
+// The content address as it appears in outputs: 16 hexadecimal digits
+
+QByteArray SequenceStore::idString( quint64 id )
+{
+    return QByteArray::number( id, 16 ).rightJustified( 16, '0' );
+}
+
+// Choose between one byte and 2 bits per base. It clears the store.
+
+void SequenceStore::setPacked( bool packed )
+{
+    clear();
+    _packed = packed;
+}
+
+bool SequenceStore::packed() const
+{
+    return _packed;
+}
+
+void SequenceStore::reserve( qsizetype sequences, qsizetype bytes )
+{
+    _data.reserve( _packed ? Nucleotides::packedSize( bytes ) : bytes );
+    _offsets.reserve( sequences + 1 );
+    _lengths.reserve( sequences );
+    _ids.reserve( sequences );
+    _index.reserve( sequences );
+    if( _packed ) _runOffsets.reserve( sequences + 1 );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'intern' returns the index of a sequence, adding it to the store if it is */
+/* not there yet                                                             */
+/*                                                                           */
+/*****************************************************************************/
+
+quint32 SequenceStore::intern( QByteArrayView sequence )
+{
+    const quint64 h = hash( sequence );
+
+    _references++;
+    _bytes += sequence.size();
+
+    for( auto it = _index.constFind( h ); it != _index.constEnd() && it.key() == h; ++it )
+    {
+        if( matches( it.value(), sequence ) ) return it.value();
+        _collisions++;
+        qDebug() << "Sequences with the same address" << idString( h );
+    }
+
+    quint32 index = _ids.size();
+
+    if( _packed )
+    {
+        Nucleotides::pack( sequence, _data, _runs );
+        _runOffsets.append( _runs.size() );
+    }
+    else
+    {
+        _data.append( sequence.data(), sequence.size() );
+    }
+    _offsets.append( _data.size() );
+    _lengths.append( quint32( sequence.size() ) );
+    _ids.append( h );
+    _index.insert( h, index );
+    _uniqueBytes += sequence.size();
+
+    return index;
+}
+
+void SequenceStore::clear()
+{
+    _data.clear();
+    _offsets    = {0};
+    _lengths.clear();
+    _ids.clear();
+    _runs.clear();
+    _runOffsets = {0};
+    _index.clear();
+    _references  = 0;
+    _bytes       = 0;
+    _uniqueBytes = 0;
+    _collisions  = 0;
+}
+
+// Number of distinct sequences
+
+qsizetype SequenceStore::size() const
+{
+    return _ids.size();
+}
+
+// A copy of sequence 'i', which stays valid whatever is interned later
+
+QByteArray SequenceStore::sequence( quint32 i ) const
+{
+    const char *data = _data.constData() + _offsets.at( i );
+
+    if( !_packed ) return QByteArray( data, _lengths.at( i ) );
+
+    const qint64 run = _runOffsets.at( i );
+    return Nucleotides::unpack( data, _lengths.at( i ),
+                                _runs.constData() + run, _runOffsets.at( i + 1 ) - run );
+}
+
+// Whether sequence 'i' has the same bases as 'sequence'. Unpacked sequences
+// are compared in place, without a copy.
+
+bool SequenceStore::matches( quint32 i, QByteArrayView sequence ) const
+{
+    if( _packed ) return sameBases( this->sequence( i ), sequence );
+
+    return sameBases( QByteArrayView( _data.constData() + _offsets.at( i ),
+                                      _lengths.at( i ) ), sequence );
+}
+
+quint64 SequenceStore::id( quint32 i ) const
+{
+    return _ids.at( i );
+}
+
+// Number of sequences interned, duplicates included, and their total size
+
+qint64 SequenceStore::references() const
+{
+    return _references;
+}
+
+qint64 SequenceStore::bytes() const
+{
+    return _bytes;
+}
+
+// Size of the distinct sequences
+
+qint64 SequenceStore::uniqueBytes() const
+{
+    return _uniqueBytes;
+}
+
+qint64 SequenceStore::collisions() const
+{
+    return _collisions;
+}
+
+// Approximate amount of memory held by the store
+
+qint64 SequenceStore::memory() const
+{
+    qint64 total = _data.capacity();
+
+    total += _offsets.capacity() * sizeof( qint64 );
+    total += _lengths.capacity() * sizeof( quint32 );
+    total += _ids.capacity() * sizeof( quint64 );
+    total += _runs.capacity() * sizeof( Nucleotides::Run );
+    total += _runOffsets.capacity() * sizeof( qint64 );
+    total += _index.size() * ( sizeof( quint64 ) + sizeof( quint32 ) );
+    return total;
+}
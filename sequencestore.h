@@ -0,0 +1,55 @@
+#ifndef SEQUENCESTORE_H
+#define SEQUENCESTORE_H
+
+#include <QByteArrayView>
+#include <QByteArray>
+#include <QList>
+#include <QHash>
+
+#include "nucleotides.h"
+
+class SequenceStore
+{
+    // Unique sequences are appended to one contiguous buffer. Sequence 'i'
+    // spans [ offsets[i], offsets[i + 1] ), has lengths[i] bases and content
+    // address ids[i]. Packed sequences take 2 bits per base in '_data'; their
+    // other symbols are the runs [ runOffsets[i], runOffsets[i + 1] ).
+
+    bool                _packed         {false};
+    QByteArray          _data;
+    QList<qint64>       _offsets        {0};
+    QList<quint32>      _lengths;
+    QList<quint64>      _ids;
+    QList<Nucleotides::Run> _runs;
+    QList<qint64>       _runOffsets     {0};
+    QMultiHash<quint64, quint32> _index;
+
+    qint64              _references     {0};
+    qint64              _bytes          {0};
+    qint64              _uniqueBytes    {0};
+    qint64              _collisions     {0};
+
+    bool            matches( quint32, QByteArrayView ) const;
+
+public:
+    SequenceStore();
+    ~SequenceStore();
+    void            setPacked( bool );
+    bool            packed() const;
+    void            reserve( qsizetype, qsizetype );
+    quint32         intern( QByteArrayView );
+    void            clear();
+    qsizetype       size() const;
+    QByteArray      sequence( quint32 ) const;
+    quint64         id( quint32 ) const;
+    qint64          references() const;
+    qint64          bytes() const;
+    qint64          uniqueBytes() const;
+    qint64          collisions() const;
+    qint64          memory() const;
+
+    static quint64  hash( QByteArrayView );
+    static QByteArray idString( quint64 );
+};
+
+#endif // SEQUENCESTORE_H
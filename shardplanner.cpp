@@ -0,0 +1,296 @@
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QUrl>
+#include <QTimer>
+#include <QDebug>
+
+#include <algorithm>
+
+#include "shardplanner.h"
+#include "gbquery.h"
+#include "esearch.h"
+
+// A 'ShardPlanner' splits the result set of a very large query into date
+// ranges ('shards') of at most '_maxShardSize' records each, so that they can
+// be searched and fetched in parallel by separate queries (see 'BatchQuery').
+// Only record counts are asked for ('esearch' with 'retmax=0'): first for the
+// whole query, and then, if it is too large, for the two halves of the range
+// of dates from '_firstDate' to tomorrow. Every half still too large is split
+// again, until each range fits or is a single day. NCBI's date ranges include
+// both of their days, so the halves [a, m] and [m + 1, b] never overlap.
+//
+// Counts go through the shared scheduler, and thus under the rate limit of
+// the queries. The 'planned' SIGNAL is emitted once every count is back, with
+// the shards in date order.
+
+ShardPlanner::ShardPlanner( Scheduler *scheduler, QObject *parent )
+    : QObject( parent )
+{
+    _scheduler = scheduler;
+}
+
+ShardPlanner::~ShardPlanner()
+{
+    if( _scheduler ) _scheduler->cancel( this );
+}
+
+void ShardPlanner::setQueryParams( const QString &organism,
+                                   const QString &marker,
+                                   const QString &key )
+{
+    _searchTerm = GbQuery::searchTerm( organism, marker );
+    _apiKey     = key;
+}
+
+void ShardPlanner::setEndpoint( const QString &scheme, const QString &host, int port )
+{
+    _scheme = scheme;
+    _host   = host;
+    _port   = port;
+}
+
+// Publication ('pdat', the default) or modification ('mdat') date
+
+void ShardPlanner::setDateType( const QString &type )
+{
+    _dateType = type;
+}
+
+void ShardPlanner::setMaxShardSize( ulong records )
+{
+    _maxShardSize = records > 0 ? records : 1;
+}
+
+void ShardPlanner::setRetries( int retries )
+{
+    _maxRetries = retries > 0 ? retries : 0;
+}
+
+QList<ShardPlanner::Shard> ShardPlanner::shards()
+{
+    return _shards;
+}
+
+// Number of records of the whole query
+
+ulong ShardPlanner::count()
+{
+    return _count;
+}
+
+// A plan has failed if a count could not be obtained, or if the server does
+// not restrict its counts to the date ranges asked for
+
+bool ShardPlanner::hasFailed()
+{
+    return _failed;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'plan' counts the records of the whole query. If they fit in one shard    */
+/* there is nothing to split.                                                */
+/*                                                                           */
+/*****************************************************************************/
+
+void ShardPlanner::plan()
+{
+    _shards.clear();
+    _failed = false;
+
+    countRange( QDate(), QDate(), [this]( ulong records ) {
+        _count = records;
+
+        if( records <= _maxShardSize )
+        {
+            _shards.append( { QDate(), QDate(), records } );
+        }
+        else
+        {
+            split( _firstDate, QDate::currentDate().addDays( 1 ), records );
+        }
+    } );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'countRange' asks 'esearch' for the number of records in a date range (or */
+/* of the whole query if the dates are not valid) and hands it to 'counted'. */
+/* Failed requests are retried, waiting twice as long every time.            */
+/*                                                                           */
+/*****************************************************************************/
+
+void ShardPlanner::countRange( const QDate &minDate, const QDate &maxDate,
+                               Counted counted, int attempt )
+{
+    if( _failed ) return;
+
+    QString query = "db=nuccore&term=" + _searchTerm +
+                    GbQuery::dateRange( _dateType, minDate, maxDate ) +
+                    "&retmax=0";
+
+    if( _apiKey != "" )
+    {
+        query += "&api_key=" + _apiKey;
+    }
+
+    QUrl url;
+
+    url.setScheme( _scheme );
+    url.setHost( _host );
+    url.setPort( _port );
+    url.setPath( _searchPath );
+    url.setQuery( query );
+
+    qDebug() << url.toString();
+
+    QNetworkRequest request( url );
+    request.setRawHeader( "Accept", "application/xml, text/xml, text/plain" );
+    request.setAttribute( QNetworkRequest::Http2AllowedAttribute, true );
+    request.setTransferTimeout( _transferTimeout );
+
+    _pending++;
+
+    _scheduler->enqueue( this, request, [this, minDate, maxDate, counted, attempt]( QNetworkReply *reply ) {
+        connect( reply, &QNetworkReply::finished, this,
+                 [this, reply, minDate, maxDate, counted, attempt]() {
+            reply->deleteLater();
+            _pending--;
+
+            bool  ok      = reply->error() == QNetworkReply::NoError;
+            ulong records {0};
+
+            if( ok )
+            {
+                Esearch esearch( reply->readAll() );
+                ok      = !esearch.hasError();
+                records = esearch.count();
+            }
+
+            if( ok )
+            {
+                if( !_failed ) counted( records );
+            }
+            else if( attempt < _maxRetries && !_failed )
+            {
+                int delay = qMin( _retryDelay << qMin( attempt, 16 ), _maxRetryDelay );
+
+                qDebug() << "Retrying count in" << delay << "ms:" << reply->errorString();
+
+                _pending++;
+                QTimer::singleShot( delay, this, [this, minDate, maxDate, counted, attempt]() {
+                    _pending--;
+                    countRange( minDate, maxDate, counted, attempt + 1 );
+                    if( _pending == 0 ) done();
+                } );
+            }
+            else
+            {
+                qDebug() << "Cannot count the records of" << _searchTerm
+                         << minDate << maxDate << ":" << reply->errorString();
+                _failed = true;
+            }
+
+            if( _pending == 0 ) done();
+        } );
+    } );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'split' counts both halves of a date range of 'total' records             */
+/*                                                                           */
+/*****************************************************************************/
+
+void ShardPlanner::split( const QDate &minDate, const QDate &maxDate, ulong total )
+{
+    QSharedPointer<Split> s( new Split );
+
+    QDate middle = minDate.addDays( minDate.daysTo( maxDate ) / 2 );
+
+    s->minDate[0] = minDate;
+    s->maxDate[0] = middle;
+    s->minDate[1] = middle.addDays( 1 );
+    s->maxDate[1] = maxDate;
+    s->total      = total;
+
+    for( int i = 0; i < 2; ++i )
+    {
+        countRange( s->minDate[i], s->maxDate[i], [this, s, i]( ulong records ) {
+            s->count[i] = records;
+            if( --s->pending == 0 ) settle( s );
+        } );
+    }
+}
+
+// Both halves of a range are counted. Records may be added while planning,
+// but halves adding up to much more than the whole mean that the server
+// ignored the dates (as the mock server of the load test does), and
+// splitting further would never end.
+
+void ShardPlanner::settle( QSharedPointer<Split> s )
+{
+    if( s->count[0] + s->count[1] > s->total + s->total / 2 )
+    {
+        qDebug() << "The server does not restrict" << _searchTerm
+                 << "to date ranges, it cannot be sharded";
+        _failed = true;
+        return;
+    }
+
+    for( int i = 0; i < 2; ++i )
+    {
+        place( s->minDate[i], s->maxDate[i], s->count[i] );
+    }
+}
+
+// A range that fits is a shard, and so is a single day, however large
+
+void ShardPlanner::place( const QDate &minDate, const QDate &maxDate, ulong records )
+{
+    if( records == 0 ) return;
+
+    if( records <= _maxShardSize || minDate == maxDate )
+    {
+        if( records > _maxShardSize )
+        {
+            qDebug() << "Shard" << minDate << "of" << _searchTerm << "has"
+                     << records << "records";
+        }
+        _shards.append( { minDate, maxDate, records } );
+        return;
+    }
+
+    split( minDate, maxDate, records );
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'done' is called once no count is pending. Records without a date in the  */
+/* planned window (before '_firstDate', or without any) would be missed, so  */
+/* the shards are checked against the count of the whole query: if they hold */
+/* fewer records the plan fails, and the query runs whole. Records added     */
+/* while planning may make them hold more, which loses nothing.              */
+/*                                                                           */
+/*****************************************************************************/
+
+void ShardPlanner::done()
+{
+    std::sort( _shards.begin(), _shards.end(), []( const Shard &a, const Shard &b ) {
+        return a.minDate < b.minDate;
+    } );
+
+    ulong records {0};
+    for( const Shard &shard : _shards ) records += shard.count;
+
+    if( !_failed && records < _count )
+    {
+        qDebug() << "The shards of" << _searchTerm << "hold" << records
+                 << "records out of" << _count << ", it cannot be sharded";
+        _failed = true;
+    }
+
+    qDebug() << "Planned" << _shards.size() << "shards for" << _searchTerm;
+
+    emit planned();
+}
@@ -0,0 +1,91 @@
+#ifndef SHARDPLANNER_H
+#define SHARDPLANNER_H
+
+#include <QString>
+#include <QList>
+#include <QDate>
+#include <QObject>
+#include <QSharedPointer>
+
+#include <functional>
+
+#include "scheduler.h"
+
+class ShardPlanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    // A date range of the result set, both days included. The whole result
+    // set is a single shard with invalid dates.
+
+    struct Shard
+    {
+        QDate           minDate;
+        QDate           maxDate;
+        ulong           count           {0};
+    };
+
+    explicit        ShardPlanner( Scheduler *, QObject * parent = nullptr );
+    ~ShardPlanner();
+    void            setQueryParams( const QString &, const QString &,
+                                    const QString & );
+    void            setEndpoint( const QString &, const QString &, int port = -1 );
+    void            setDateType( const QString & );
+    void            setMaxShardSize( ulong );
+    void            setRetries( int );
+    QList<Shard>    shards();
+    ulong           count();
+    bool            hasFailed();
+
+signals:
+    void            planned();
+
+public slots:
+    void            plan();
+
+private:
+    QString         _apiKey         {""};
+    QString         _searchTerm     {""};
+    QString         _scheme         {"https"};
+    QString         _host           {"eutils.ncbi.nlm.nih.gov"};
+    int             _port           {-1};
+    QString         _searchPath     {"/entrez/eutils/esearch.fcgi"};
+    QString         _dateType       {"pdat"};
+    QDate           _firstDate      {1900, 1, 1};
+    ulong           _maxShardSize   {10000};
+
+    int             _maxRetries     {5};
+    int             _retryDelay     {1000};
+    int             _maxRetryDelay  {60000};
+    int             _transferTimeout{120000};
+
+    ulong           _count          {0};
+    int             _pending        {0};
+    bool            _failed         {false};
+    QList<Shard>    _shards;
+
+    QPointer<Scheduler>             _scheduler;
+
+    // The two halves of a date range, counted together
+
+    struct Split
+    {
+        QDate           minDate[2];
+        QDate           maxDate[2];
+        ulong           count[2]        {0, 0};
+        int             pending         {2};
+        ulong           total           {0};
+    };
+
+    using Counted = std::function<void( ulong )>;
+
+    void            countRange( const QDate &, const QDate &, Counted,
+                                int attempt = 0 );
+    void            split( const QDate &, const QDate &, ulong );
+    void            settle( QSharedPointer<Split> );
+    void            place( const QDate &, const QDate &, ulong );
+    void            done();
+};
+
+#endif // SHARDPLANNER_H
@@ -0,0 +1,186 @@
+#ifndef XMLTAGS_H
+#define XMLTAGS_H
+
+#include <QStringView>
+
+#include <array>
+
+// Element names returned by QXmlStreamReader::name() are QStringViews into the
+// reader's own buffer. Turning each of them into a QString (one allocation per
+// token) just to compare it with a few literals is a waste, since the vast
+// majority of tokens in a <GBSet> are of no interest to us. Instead, names are
+// looked up in a small table built at compile time: the hash of the view
+// selects a single slot, and a single comparison of UTF-16 code units tells
+// whether the name is really the one stored there. The hash seed is searched
+// at compile time so that no two names share a slot (a perfect hash), and a
+// static_assert guarantees it stays that way when new names are added.
+//
+// The same table is used for XML element names and for the names found in
+// <GBQualifier_name> and <GBFeature_key> elements (such as "organism").
+
+namespace XmlTags
+{
+
+enum class Tag
+{
+    Unknown,
+
+    // eSearchResult, ePostResult
+    Count,
+    RetMax,
+    RetStart,
+    QueryKey,
+    WebEnv,
+    Id,
+    TranslationSet,
+    TranslationStack,
+    QueryTranslation,
+    Error,
+
+    // GBSet
+    GBSeq,
+    GBSeqSequence,
+    GBSeqAccessionVersion,
+    GBSeqOtherSeqids,
+    GBSeqid,
+    GBSeqFeatureTable,
+    GBFeatureKey,
+    GBFeatureQuals,
+    GBQualifierName,
+    GBQualifierValue,
+
+    // eSummaryResult
+    DocumentSummary,
+    AccessionVersion,
+    SummaryOrganism,
+    SubType,
+    SubName,
+
+    // Qualifier names and feature keys
+    Organism,
+    Country,
+    Source
+};
+
+struct Entry
+{
+    const char16_t *name;
+    qsizetype       size;
+    Tag             tag;
+
+    constexpr Entry( const char16_t *n, Tag t )
+        : name( n ), size( length( n ) ), tag( t ) {}
+
+    static constexpr qsizetype length( const char16_t *n )
+    {
+        qsizetype l = 0;
+        while( n[l] ) ++l;
+        return l;
+    }
+};
+
+// Entry 0 is a sentinel that never matches (empty slots point to it)
+
+constexpr Entry entries[] = {
+    { u"",                          Tag::Unknown                },
+    { u"Count",                     Tag::Count                  },
+    { u"RetMax",                    Tag::RetMax                 },
+    { u"RetStart",                  Tag::RetStart               },
+    { u"QueryKey",                  Tag::QueryKey               },
+    { u"WebEnv",                    Tag::WebEnv                 },
+    { u"Id",                        Tag::Id                     },
+    { u"TranslationSet",            Tag::TranslationSet         },
+    { u"TranslationStack",          Tag::TranslationStack       },
+    { u"QueryTranslation",          Tag::QueryTranslation       },
+    { u"ERROR",                     Tag::Error                  },
+    { u"GBSeq",                     Tag::GBSeq                  },
+    { u"GBSeq_sequence",            Tag::GBSeqSequence          },
+    { u"GBSeq_accession-version",   Tag::GBSeqAccessionVersion  },
+    { u"GBSeq_other-seqids",        Tag::GBSeqOtherSeqids       },
+    { u"GBSeqid",                   Tag::GBSeqid                },
+    { u"GBSeq_feature-table",       Tag::GBSeqFeatureTable      },
+    { u"GBFeature_key",             Tag::GBFeatureKey           },
+    { u"GBFeature_quals",           Tag::GBFeatureQuals         },
+    { u"GBQualifier_name",          Tag::GBQualifierName        },
+    { u"GBQualifier_value",         Tag::GBQualifierValue       },
+    { u"DocumentSummary",           Tag::DocumentSummary        },
+    { u"AccessionVersion",          Tag::AccessionVersion       },
+    { u"Organism",                  Tag::SummaryOrganism        },
+    { u"SubType",                   Tag::SubType                },
+    { u"SubName",                   Tag::SubName                },
+    { u"organism",                  Tag::Organism               },
+    { u"country",                   Tag::Country                },
+    { u"source",                    Tag::Source                 }
+};
+
+constexpr qsizetype entryCount = sizeof( entries ) / sizeof( entries[0] );
+constexpr quint32   tableSize  = 64;
+
+static_assert( entryCount < tableSize, "XmlTags table is too small" );
+
+// FNV-1a over the UTF-16 code units, mixed with a seed
+
+constexpr quint32 hash( const char16_t *s, qsizetype n, quint32 seed )
+{
+    quint32 h = 2166136261u ^ seed;
+    for( qsizetype i = 0; i < n; ++i )
+    {
+        h ^= s[i];
+        h *= 16777619u;
+    }
+    return h ^ ( h >> 15 );
+}
+
+constexpr bool isPerfect( quint32 seed )
+{
+    std::array<bool, tableSize> used {};
+    for( qsizetype i = 1; i < entryCount; ++i )
+    {
+        quint32 slot = hash( entries[i].name, entries[i].size, seed ) % tableSize;
+        if( used[slot] ) return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr quint32 findSeed()
+{
+    quint32 seed = 0;
+    while( !isPerfect( seed ) && seed < 100000 ) ++seed;
+    return seed;
+}
+
+constexpr quint32 seed = findSeed();
+
+static_assert( isPerfect( seed ), "No perfect hash seed found for XmlTags" );
+
+constexpr std::array<quint8, tableSize> buildSlots()
+{
+    std::array<quint8, tableSize> slots {};
+    for( qsizetype i = 1; i < entryCount; ++i )
+    {
+        slots[ hash( entries[i].name, entries[i].size, seed ) % tableSize ] = quint8( i );
+    }
+    return slots;
+}
+
+constexpr std::array<quint8, tableSize> slots = buildSlots();
+
+/*****************************************************************************/
+/*                                                                           */
+/* 'lookup' returns the Tag of a name, or Tag::Unknown. It never allocates.  */
+/*                                                                           */
+/*****************************************************************************/
+
+inline Tag lookup( QStringView name )
+{
+    const Entry &e = entries[ slots[ hash( name.utf16(), name.size(), seed ) % tableSize ] ];
+
+    if( e.size != name.size() ) return Tag::Unknown;
+
+    return QStringView( e.name, e.size ) == name ? e.tag : Tag::Unknown;
+}
+
+} // namespace XmlTags
+
+#endif // XMLTAGS_H